@@ -51,12 +51,14 @@ public:
     string gui_server_port = "20210";
 
     pollfd get_game_server_poll() {
-        return create_connection(resolve_host(game_server, SOCK_DGRAM, game_server_port),
+        sockaddr_storage addr{};
+        return create_connection(resolve_host(game_server, SOCK_DGRAM, game_server_port, addr),
                                  SOCK_DGRAM, IPPROTO_UDP);
     }
 
     pollfd get_gui_server_poll() {
-        return create_connection(resolve_host(gui_server, SOCK_STREAM, gui_server_port),
+        sockaddr_storage addr{};
+        return create_connection(resolve_host(gui_server, SOCK_STREAM, gui_server_port, addr),
                                  SOCK_STREAM, IPPROTO_TCP);
     }
 };
@@ -73,32 +75,124 @@ private:
         return iter->second;
     }
 
-    string create_msg_to_server() {
-        return ClientToServerMsg(session_id, direction,
-                                 next_expected_event_no, player_name).serialize();
+    /* Writes message to server into buffer of MAX_CLIENT_MSG_LEN bytes and returns its
+     * size. */
+    size_t create_msg_to_server(char *buffer) {
+        ByteWriter writer(buffer, MAX_CLIENT_MSG_LEN);
+        ClientToServerMsg(session_id, direction, next_expected_event_no,
+                          player_name).serialize(writer);
+        return writer.size();
+    }
+
+    /* Serializes event to format specified for gui message. Returns empty string for
+     * events which are not reported to gui. */
+    string to_gui_msg(const EventView &event) {
+        if (event.event_type == NEW_GAME) {
+            string ret = string(NewGameData::name) + " " + std::to_string(event.maxx) + " "
+                         + std::to_string(event.maxy);
+            for (auto &str: names) {
+                if (!player_name_valid(str) || str.empty()) {
+                    exit_error("Received incorrect player name");
+                }
+                ret.append(" " + str);
+            }
+            return ret;
+        }
+        if (event.event_type == GAME_OVER) {
+            return string();
+        }
+        if (event.player_number >= names.size()) {
+            exit_error("Received bad player number");
+        }
+        if (event.event_type == PIXEL) {
+            return string(PixelData::name) + " " + std::to_string(event.x) + " "
+                   + std::to_string(event.y) + " " + names[event.player_number];
+        }
+        return string(PlayerEliminatedData::name) + " " + names[event.player_number];
+    }
+
+    /* Serializes snapshot part to gui messages, one for every eliminated player and every
+     * eaten pixel. Eliminations are reported only with the snapshot's first part. Client is
+     * terminated if the snapshot does not match the current game. */
+    string snapshot_to_gui_msgs(const EventView &event) {
+        string ret;
+        if (event.part >= event.parts) {
+            exit_error("Incorrect snapshot");
+        }
+        if (event.part == 0) {
+            for (size_t num = 0; num < names.size(); ++num) {
+                if ((event.eliminated >> num) & 1) {
+                    ret.append(string(PlayerEliminatedData::name) + " " + names[num] + "\n");
+                }
+            }
+        }
+
+        uint64_t pixel = event.first_pixel, pixels = (uint64_t) maxx * maxy;
+        for (size_t run = 0; run < event.run_count(); ++run) {
+            uint8_t owner;
+            uint32_t skip, length;
+            event.run(run, owner, skip, length);
+            pixel += skip;
+            if (pixel + length > pixels || owner >= names.size()) {
+                exit_error("Incorrect snapshot");
+            }
+            for (uint64_t end = pixel + length; pixel < end; ++pixel) {
+                ret.append(string(PixelData::name) + " " + std::to_string(pixel % maxx) + " "
+                           + std::to_string(pixel / maxx) + " " + names[owner] + "\n");
+            }
+        }
+        return ret;
     }
 
     /* Function saves and validates data sent from server. In case of incorrect values
-     * client is terminated. If data is valid, function creates new message to gui. */
+     * client is terminated. If data is valid, function creates new message to gui.
+     * Events are decoded directly from the buffer. */
     string create_msgs_to_gui(char *buffer, size_t len) {
-        ServerMsg msg(buffer, len);
+        ServerMsgReader msg(buffer, len);
+        EventView event;
         string ret;
 
-        for (auto &event: msg.events) {
+        while (msg.next(event)) {
+            if (event.event_type == SNAPSHOT) {
+                // Snapshot describes all events up to its number once all parts arrived.
+                // Until then the same events are expected, so the server sends it again.
+                if (game_id == msg.game_id && !names.empty()
+                    && event.event_no >= next_expected_event_no) {
+                    string part = snapshot_to_gui_msgs(event);
+                    if (snapshot_parts.add(event)) {
+                        ret.append(part);
+                    }
+                    if (snapshot_parts.complete()) {
+                        next_expected_event_no = event.event_no + 1;
+                        snapshot_parts.reset();
+                    }
+                }
+                continue;
+            }
+            if (game_id == msg.game_id
+                && snapshot_parts.blocks(next_expected_event_no, event.event_no)) {
+                continue;
+            }
+
             if (event.event_type == NEW_GAME) {
                 next_expected_event_no = 0;
+                snapshot_parts.reset();
                 game_id = msg.game_id;
-                auto &data = dynamic_cast<NewGameData &>(*(event.event_data));
-                maxx = data.maxx;
-                maxy = data.maxy;
-                if (data.player_names.size() < 2 || PLAYERS_LIMIT < data.player_names.size()) {
+                maxx = event.maxx;
+                maxy = event.maxy;
+                names.clear();
+                size_t pos = 0;
+                string_view name;
+                while (event.next_name(pos, name)) {
+                    names.emplace_back(name);
+                }
+                if (names.size() < 2 || PLAYERS_LIMIT < names.size()) {
                     exit_error("Incorrect players number");
                 }
             }
 
             if (event.event_type == PIXEL) {
-                auto &data = dynamic_cast<PixelData &>(*(event.event_data));
-                if (data.x >= maxx || data.y >= maxy) { // Bad values
+                if (event.x >= maxx || event.y >= maxy) { // Bad values
                     exit_error("Incorrect pixel values");
                 }
             }
@@ -108,7 +202,7 @@ private:
                 next_expected_event_no = 0;
             }
             if (event.event_type != GAME_OVER) {
-                ret.append(event.event_data->to_gui_msg(names) + "\n");
+                ret.append(to_gui_msg(event) + "\n");
             }
         }
         return ret;
@@ -125,10 +219,9 @@ private:
     }
 
     /* Write to socket with error control. */
-    static void write_to_socket(const string &msg, int sock, const string &err_msg) {
-        char buffer[DATAGRAM_SIZE];
-        memcpy(buffer, msg.c_str(), msg.length());
-        if (write(sock, buffer, msg.length()) <= 0) {
+    static void write_to_socket(const char *msg, size_t len, int sock,
+                                const string &err_msg) {
+        if (write(sock, msg, len) <= 0) {
             exit_error(err_msg);
         }
     }
@@ -140,6 +233,7 @@ public:
     uint32_t session_id = Timer::get_session_id();
     uint8_t direction{};
     uint32_t next_expected_event_no = 0;
+    SnapshotParts snapshot_parts; // Of the current game
     vector<string> names;
     string player_name;
     pollfd game_server{};
@@ -224,8 +318,8 @@ public:
             }
 
             if (timer.timeout(MILLIS)) {
-                string msg = create_msg_to_server();
-                write_to_socket(msg, game_server.fd, "Send to game server error");
+                size_t msg_len = create_msg_to_server(buffer);
+                write_to_socket(buffer, msg_len, game_server.fd, "Send to game server error");
                 timer.start();
             }
 
@@ -239,7 +333,8 @@ public:
                 string msgs_to_gui = create_msgs_to_gui(buffer, rcv_len);
 
                 if (!msgs_to_gui.empty()) {
-                    write_to_socket(msgs_to_gui, gui_server.fd, "Error write to gui");
+                    write_to_socket(msgs_to_gui.c_str(), msgs_to_gui.length(), gui_server.fd,
+                                    "Error write to gui");
                 }
             }
         }
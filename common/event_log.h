@@ -0,0 +1,132 @@
+#ifndef SCREEN_WORMS_EVENT_LOG_H
+#define SCREEN_WORMS_EVENT_LOG_H
+
+#include <string>
+#include <vector>
+#include "events.h"
+#include "../utils/wire.h"
+
+using namespace std;
+
+/* Append-only log of events of a single game, kept in the wire format (fields from len to
+ * crc32) in one contiguous arena indexed by event number. Every event is serialized and
+ * checksummed exactly once, when it is appended. A PIXEL event takes 22 bytes of the arena
+ * and 4 bytes of its offset. Clearing keeps the memory, so once the log has grown to the
+ * size of a typical game appending does not allocate.
+ *
+ * Snapshots and events copied with append_encoded keep their own event numbers, so a log
+ * containing them is indexed by position only. */
+class EventLog {
+private:
+    string bytes;
+    vector<uint32_t> offsets; // offsets[i] is the position of i-th event in bytes
+
+    static const size_t HEADER_SIZE = 2 * sizeof(uint32_t) + sizeof(uint8_t);
+
+    /* Makes room for new event at the end of the arena and writes its fields len,
+     * event_no and event_type. Returns writer positioned at event_data. */
+    ByteWriter begin_event(EventType event_type, size_t data_size, size_t event_no) {
+        size_t start = bytes.size();
+        size_t event_size = HEADER_SIZE + data_size + sizeof(uint32_t);
+        offsets.push_back(start);
+        bytes.resize(start + event_size);
+
+        ByteWriter writer(&bytes[start], event_size);
+        writer.write32(sizeof(uint32_t) + sizeof(uint8_t) + data_size);
+        writer.write32(event_no);
+        writer.write8(event_type);
+        return writer;
+    }
+
+    /* Writes crc32 of the last event. */
+    static void end_event(ByteWriter &writer) {
+        writer.write32(::crc32(writer.begin(), writer.size()));
+    }
+
+public:
+    EventLog() = default;
+
+    void append_new_game(uint32_t maxx, uint32_t maxy, const vector<string> &player_names) {
+        size_t data_size = 2 * sizeof(uint32_t);
+        for (auto &name: player_names) {
+            data_size += name.size() + sizeof('\0');
+        }
+        ByteWriter writer = begin_event(NEW_GAME, data_size, size());
+        writer.write32(maxx);
+        writer.write32(maxy);
+        for (auto &name: player_names) {
+            writer.write_bytes(name.c_str(), name.size() + sizeof('\0'));
+        }
+        end_event(writer);
+    }
+
+    void append_pixel(uint8_t player_number, uint32_t x, uint32_t y) {
+        ByteWriter writer = begin_event(PIXEL, sizeof(uint8_t) + 2 * sizeof(uint32_t), size());
+        writer.write8(player_number);
+        writer.write32(x);
+        writer.write32(y);
+        end_event(writer);
+    }
+
+    void append_player_eliminated(uint8_t player_number) {
+        ByteWriter writer = begin_event(PLAYER_ELIMINATED, sizeof(uint8_t), size());
+        writer.write8(player_number);
+        end_event(writer);
+    }
+
+    void append_game_over() {
+        ByteWriter writer = begin_event(GAME_OVER, 0, size());
+        end_event(writer);
+    }
+
+    /* Appends snapshot with given event number, runs are already encoded. */
+    void append_snapshot(size_t event_no, uint8_t part, uint8_t parts, uint32_t eliminated,
+                         uint32_t first_pixel, string_view runs) {
+        ByteWriter writer = begin_event(SNAPSHOT, 2 * sizeof(uint8_t) + 2 * sizeof(uint32_t)
+                                                  + runs.size(), event_no);
+        writer.write8(part);
+        writer.write8(parts);
+        writer.write32(eliminated);
+        writer.write32(first_pixel);
+        writer.write_bytes(runs);
+        end_event(writer);
+    }
+
+    /* Appends copy of an event in the wire format. */
+    void append_encoded(const char *event, size_t length) {
+        offsets.push_back(bytes.size());
+        bytes.append(event, length);
+    }
+
+    /* Removes all events but keeps allocated memory for the next game. */
+    void clear() {
+        bytes.clear();
+        offsets.clear();
+    }
+
+    size_t size() const {
+        return offsets.size();
+    }
+
+    bool empty() const {
+        return offsets.empty();
+    }
+
+    /* Returns number of bytes taken by all events. */
+    size_t byte_size() const {
+        return bytes.size();
+    }
+
+    /* Returns pointer to the beginning of encoded event with given number. */
+    const char *data(size_t event_no) const {
+        return bytes.data() + offsets[event_no];
+    }
+
+    /* Returns byte length of encoded event with given number. */
+    size_t length(size_t event_no) const {
+        size_t end = event_no + 1 < offsets.size() ? offsets[event_no + 1] : bytes.size();
+        return end - offsets[event_no];
+    }
+};
+
+#endif //SCREEN_WORMS_EVENT_LOG_H
@@ -6,7 +6,10 @@
 #include <vector>
 #include <cstring>
 #include <memory>
+#include <string_view>
 #include "../utils/util_func.h"
+#include "../utils/crc32.h"
+#include "../utils/wire.h"
 #include "../common/exceptions.h"
 
 using namespace std;
@@ -16,34 +19,181 @@ enum EventType {
     PIXEL = 1,
     PLAYER_ELIMINATED = 2,
     GAME_OVER = 3,
+    SNAPSHOT = 4,
 };
 
+#define SNAPSHOT_RUN_SIZE (sizeof(uint8_t) + 2 * sizeof(uint32_t))
+
 class EventData {
 public:
     /* Returns byte size of the event data. */
     virtual size_t size() = 0;
 
     /* Serializes event data into format specified for server message. */
-    virtual string serialize() = 0;
+    virtual void serialize(ByteWriter &writer) = 0;
+};
+
+/* Event decoded in place from received bytes, without copying or allocating. Only fields
+ * of event_data which belong to event_type are set. Player names of NEW_GAME event stay
+ * encoded in names and point into the buffer event was read from. */
+class EventView {
+private:
+    static bool correct_event_type(uint8_t type) {
+        return type <= SNAPSHOT;
+    }
+
+public:
+    uint32_t len{};
+    uint32_t event_no{};
+    uint8_t event_type{};
+    uint32_t maxx{}; // NEW_GAME
+    uint32_t maxy{}; // NEW_GAME
+    string_view names; // NEW_GAME, player names each followed by '\0'
+    uint8_t player_number{}; // PIXEL, PLAYER_ELIMINATED
+    uint32_t x{}; // PIXEL
+    uint32_t y{}; // PIXEL
+    uint8_t part{}; // SNAPSHOT, index of this part among parts of the snapshot
+    uint8_t parts{}; // SNAPSHOT, number of parts of the snapshot
+    uint32_t eliminated{}; // SNAPSHOT, bit set for every eliminated player
+    uint32_t first_pixel{}; // SNAPSHOT, row-major index of the first pixel of runs
+    string_view runs; // SNAPSHOT, runs of eaten pixels encoded as owner, skip and length
+    uint32_t crc32{};
+
+    /* Reads single event from reader. Event of unknown type is skipped and reported with
+     * UnknownEventTypeException, so reading may continue with the next one. Throws
+     * IncorrectCrc32Exception or TruncatedMessageException if the event is corrupted. */
+    static EventView read(ByteReader &reader) {
+        EventView event;
+        const char *start = reader.current();
+        size_t num_size = sizeof(uint32_t) + sizeof(uint8_t);
+
+        event.len = reader.read32();
+        if (event.len < num_size) {
+            throw TruncatedMessageException();
+        }
+        ByteReader fields(reader.read_bytes(event.len + sizeof(uint32_t)));
+        event.event_no = fields.read32();
+        event.event_type = fields.read8();
+        if (!correct_event_type(event.event_type)) {
+            throw UnknownEventTypeException();
+        }
+
+        ByteReader data(fields.read_bytes(event.len - num_size));
+        event.crc32 = fields.read32();
+        if (event.crc32 != ::crc32(start, sizeof(uint32_t) + event.len)) {
+            throw IncorrectCrc32Exception();
+        }
+
+        if (event.event_type == NEW_GAME) {
+            event.maxx = data.read32();
+            event.maxy = data.read32();
+            event.names = data.read_rest();
+        }
+        else if (event.event_type == PIXEL) {
+            event.player_number = data.read8();
+            event.x = data.read32();
+            event.y = data.read32();
+        }
+        else if (event.event_type == PLAYER_ELIMINATED) {
+            event.player_number = data.read8();
+        }
+        else if (event.event_type == SNAPSHOT) {
+            event.part = data.read8();
+            event.parts = data.read8();
+            event.eliminated = data.read32();
+            event.first_pixel = data.read32();
+            event.runs = data.read_rest();
+            if (event.runs.size() % SNAPSHOT_RUN_SIZE != 0) {
+                throw TruncatedMessageException();
+            }
+        }
+        return event;
+    }
+
+    /* Finds next non-empty player name in names starting from position pos, which is moved
+     * behind it. Returns false if there are no more names. */
+    bool next_name(size_t &pos, string_view &name) const {
+        pos = names.find_first_not_of('\0', pos);
+        if (pos == string_view::npos) {
+            return false;
+        }
+        size_t end = min(names.find('\0', pos), names.size());
+        name = names.substr(pos, end - pos);
+        pos = end;
+        return true;
+    }
+
+    /* Reads run of snapshot number run into owner, number of free pixels between the
+     * previous run (or first_pixel) and this one, and length. */
+    void run(size_t run, uint8_t &owner, uint32_t &skip, uint32_t &length) const {
+        ByteReader reader(runs.substr(run * SNAPSHOT_RUN_SIZE, SNAPSHOT_RUN_SIZE));
+        owner = reader.read8();
+        skip = reader.read32();
+        length = reader.read32();
+    }
+
+    size_t run_count() const {
+        return runs.size() / SNAPSHOT_RUN_SIZE;
+    }
+};
+
+/* Parts of a snapshot received by a client. Parts are collected until all of them arrive,
+ * only then the snapshot describes events up to its number. Parts of a snapshot with
+ * another number, or another number of parts, start a new collection. */
+class SnapshotParts {
+private:
+    uint32_t event_no = 0;
+    vector<bool> received;
+    size_t missing = 0;
+
+public:
+    void reset() {
+        received.clear();
+        missing = 0;
+    }
+
+    /* Records part of a snapshot, its part must be below parts. Returns false if the part
+     * was already received. */
+    bool add(const EventView &event) {
+        if (received.empty() || event.event_no != event_no || event.parts != received.size()) {
+            event_no = event.event_no;
+            received.assign(event.parts, false);
+            missing = event.parts;
+        }
+        if (received[event.part]) {
+            return false;
+        }
+        received[event.part] = true;
+        --missing;
+        return true;
+    }
 
-    /* Serializes event data to format specified for gui message format. */
-    virtual string to_gui_msg(vector<string> &pl_names) = 0;
+    bool complete() const {
+        return !received.empty() && missing == 0;
+    }
+
+    /* Returns true if event with given number has to wait until missing parts of a
+     * snapshot arrive, for a client expecting event next_expected. */
+    bool blocks(uint32_t next_expected, uint32_t event) const {
+        return missing > 0 && next_expected <= event_no && event > event_no;
+    }
 };
 
 class NewGameData : public EventData {
 public:
-    string name = "NEW_GAME";
+    static constexpr const char *name = "NEW_GAME";
     uint32_t maxx; // 4 bajty, szerokość planszy w pikselach, liczba bez znaku
     uint32_t maxy; // 4 bajty, wysokość planszy w pikselach, liczba bez znaku
     // następnie lista nazw graczy zawierająca dla każdego z graczy player_name oraz znak '\0'
     vector<string> player_names; // 0–20 znaków ASCII o wartościach z przedziału 33–126,
     // w szczególności spacje nie są dozwolone
 
-    NewGameData(const string &str) {
-        maxx = deserialize32(str.substr(0, 4));
-        maxy = deserialize32(str.substr(4, 4));
-        string names = str.substr(8, str.length() - 8);
-        player_names = split(names, string("\0", 1));
+    explicit NewGameData(const EventView &event) : maxx(event.maxx), maxy(event.maxy) {
+        size_t pos = 0;
+        string_view name;
+        while (event.next_name(pos, name)) {
+            player_names.emplace_back(name);
+        }
     }
 
     NewGameData(uint32_t maxx, uint32_t maxy, const vector<string> &player_names) :
@@ -59,39 +209,26 @@ public:
         return 2 * sizeof(uint32_t) + vec_size;
     }
 
-    string serialize() override {
-        string ret = serialize32(maxx) + serialize32(maxy);
-        for (auto &str: player_names) {
-            ret.append(str + string("\0", 1));
-        }
-        return ret;
-    }
-
-    string to_gui_msg(vector<string> &pl_names) override {
-        pl_names = player_names;
-        string ret = name + " " + std::to_string(maxx) + " " + std::to_string(maxy);
+    void serialize(ByteWriter &writer) override {
+        writer.write32(maxx);
+        writer.write32(maxy);
         for (auto &str: player_names) {
-            if (!player_name_valid(str) || str.empty()) {
-                exit_error("Received incorrect player name");
-            }
-            ret.append(" " + str);
+            writer.write_bytes(str.c_str(), str.size() + sizeof('\0'));
         }
-        return ret;
     }
 };
 
 class PixelData : public EventData {
 public:
-    string name = "PIXEL";
+    static constexpr const char *name = "PIXEL";
     uint8_t player_number; // 1 bajt
     uint32_t x; // 4 bajty, odcięta, liczba bez znaku
     uint32_t y; // 4 bajty, rzędna, liczba bez znaku
 
-    PixelData(const string &str) {
-        player_number = deserialize8(str.substr(0, 1));
-        x = deserialize32(str.substr(1, 4));
-        y = deserialize32(str.substr(5, 4));
-    }
+    explicit PixelData(const EventView &event) :
+            player_number(event.player_number),
+            x(event.x),
+            y(event.y) {}
 
     PixelData(uint8_t player_number, uint32_t x, uint32_t y) : player_number(player_number),
                                                                x(x), y(y) {}
@@ -100,27 +237,20 @@ public:
         return sizeof(uint8_t) + 2 * sizeof(uint32_t);
     }
 
-    string serialize() override {
-        return serialize8(player_number) + serialize32(x) + serialize32(y);
-    }
-
-    string to_gui_msg(vector<string> &pl_names) override {
-        if (player_number >= pl_names.size()) {
-            exit_error("Received bad player number");
-        }
-        return name + " " + std::to_string(x) + " " + std::to_string(y) + " " +
-               pl_names[player_number];
+    void serialize(ByteWriter &writer) override {
+        writer.write8(player_number);
+        writer.write32(x);
+        writer.write32(y);
     }
 };
 
 class PlayerEliminatedData : public EventData {
 public:
-    string name = "PLAYER_ELIMINATED";
+    static constexpr const char *name = "PLAYER_ELIMINATED";
     uint8_t player_number; // 1 bajt;
 
-    PlayerEliminatedData(const string &str) {
-        player_number = deserialize8(str.substr(0, 1));
-    }
+    explicit PlayerEliminatedData(const EventView &event) :
+            player_number(event.player_number) {}
 
     explicit PlayerEliminatedData(uint8_t player_number) : player_number(player_number) {}
 
@@ -128,21 +258,14 @@ public:
         return sizeof(uint8_t);
     }
 
-    string serialize() override {
-        return serialize8(player_number);
-    }
-
-    string to_gui_msg(vector<string> &pl_names) override {
-        if (player_number >= pl_names.size()) {
-            exit_error("Received bad player number");
-        }
-        return name + " " + pl_names[player_number];
+    void serialize(ByteWriter &writer) override {
+        writer.write8(player_number);
     }
 };
 
 class GameOverData : public EventData {
 public:
-    string name = "GAME_OVER";
+    static constexpr const char *name = "GAME_OVER";
 
     GameOverData() = default;
 
@@ -150,31 +273,46 @@ public:
         return 0;
     }
 
-    string serialize() override {
-        return string();
-    }
-
-    string to_gui_msg(vector<string> &) override {
-        return string();
-    }
+    void serialize(ByteWriter &) override {}
 };
 
-class Event {
-private:
-    string body_serialize() {
-        return serialize32(len) + serialize32(event_no) +
-               serialize8(event_type) + event_data->serialize();
+/* Part of the board state after all events up to the snapshot's event_no. All parts of a
+ * snapshot share its event_no, so they are numbered to let a client tell when it has got
+ * all of them. Eaten pixels starting from first_pixel are described row by row by runs of
+ * pixels with the same owner. Free pixels are only skipped, so snapshot grows with pixels
+ * eaten, not with board size. */
+class SnapshotData : public EventData {
+public:
+    static constexpr const char *name = "SNAPSHOT";
+    uint8_t part; // 1 bajt, numer części migawki, począwszy od zera
+    uint8_t parts; // 1 bajt, liczba części migawki
+    uint32_t eliminated; // 4 bajty, bit i ustawiony, jeśli gracz i został wyeliminowany
+    uint32_t first_pixel; // 4 bajty, numer pierwszego piksela, wierszami
+    // następnie ciągi zjedzonych pikseli: 1 bajt właściciela, 4 bajty liczby wolnych
+    // pikseli przed ciągiem i 4 bajty długości
+    string runs;
+
+    explicit SnapshotData(const EventView &event) :
+            part(event.part),
+            parts(event.parts),
+            eliminated(event.eliminated),
+            first_pixel(event.first_pixel),
+            runs(event.runs) {}
+
+    size_t size() override {
+        return 2 * sizeof(uint8_t) + 2 * sizeof(uint32_t) + runs.size();
     }
 
-    static bool correct_event_type(uint8_t type) {
-        for (uint8_t t = NEW_GAME; t <= GAME_OVER; ++t) {
-            if (type == t) {
-                return true;
-            }
-        }
-        return false;
+    void serialize(ByteWriter &writer) override {
+        writer.write8(part);
+        writer.write8(parts);
+        writer.write32(eliminated);
+        writer.write32(first_pixel);
+        writer.write_bytes(runs);
     }
+};
 
+class Event {
 public:
     uint32_t len; // 4 bajty, liczba bez znaku, sumaryczna długość pól event_*
     uint32_t event_no{}; // 4 bajty, liczba bez znaku, dla każdej partii kolejne wartości, począwszy od zera
@@ -185,34 +323,26 @@ public:
 
     Event() = default;
 
-    explicit Event(const string &msg) {
-        len = deserialize32(msg.substr(0, 4));
-        event_no = deserialize32(msg.substr(4, 4));
-        event_type = (EventType) deserialize8(msg.substr(8, 1));
-
-        if (!correct_event_type(event_type)) {
-            throw UnknownEventTypeException();
-        }
-
-        string body = msg.substr(0, msg.length() - 4);
-        crc32 = deserialize32(msg.substr(msg.length() - 4, 4));
-        if (crc32 != ::crc32(body.c_str(), body.length())) {
-            throw IncorrectCrc32Exception();
-        }
-
-        size_t num_size = 2 * sizeof(uint32_t) + sizeof(uint8_t);
-        string data_str = body.substr(num_size, body.length() - num_size);
+    /* Copies decoded event into its own data. */
+    explicit Event(const EventView &event) :
+            len(event.len),
+            event_no(event.event_no),
+            event_type((EventType) event.event_type),
+            crc32(event.crc32) {
         if (event_type == NEW_GAME) {
-            event_data = make_shared<NewGameData>(NewGameData(data_str));
+            event_data = make_shared<NewGameData>(event);
         }
         else if (event_type == PIXEL) {
-            event_data = make_shared<PixelData>(PixelData(data_str));
+            event_data = make_shared<PixelData>(event);
         }
         else if (event_type == PLAYER_ELIMINATED) {
-            event_data = make_shared<PlayerEliminatedData>(PlayerEliminatedData(data_str));
+            event_data = make_shared<PlayerEliminatedData>(event);
+        }
+        else if (event_type == SNAPSHOT) {
+            event_data = make_shared<SnapshotData>(event);
         }
         else { // GAME_OVER
-            event_data = make_shared<GameOverData>(GameOverData());
+            event_data = make_shared<GameOverData>();
         }
     }
 
@@ -223,15 +353,20 @@ public:
         len = sizeof(uint32_t) + 1 + event_data->size();
     }
 
-    uint32_t calc_crc32(const string &body_str) {
-        return ::crc32(body_str.c_str(),
-                       body_str.length()); // c_str adds \0 but length() doesn't count this
+    /* Returns byte size of the whole serialized event. */
+    size_t size() {
+        return 2 * sizeof(uint32_t) + len;
     }
 
-    string serialize() {
-        string body_str = body_serialize();
-        crc32 = calc_crc32(body_str);
-        return body_str + serialize32(crc32);
+    /* Serializes event into writer, crc32 is calculated over bytes just written. */
+    void serialize(ByteWriter &writer) {
+        size_t start = writer.size();
+        writer.write32(len);
+        writer.write32(event_no);
+        writer.write8(event_type);
+        event_data->serialize(writer);
+        crc32 = ::crc32(writer.begin() + start, writer.size() - start);
+        writer.write32(crc32);
     }
 };
 
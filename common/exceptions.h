@@ -14,6 +14,16 @@ public:
     IncorrectCrc32Exception() = default;
 };
 
+class TruncatedMessageException : public std::exception {
+public:
+    TruncatedMessageException() = default;
+};
+
+class BufferTooSmallException : public std::exception {
+public:
+    BufferTooSmallException() = default;
+};
+
 class IncorrectNumberException : public std::exception {
 private:
     char c;
@@ -39,4 +49,16 @@ public:
     }
 };
 
+class IoBackendException : public std::exception {
+private:
+    std::string msg;
+
+public:
+    explicit IoBackendException(std::string str) : msg(std::move(str)) {};
+
+    const char *what() {
+        return msg.c_str();
+    }
+};
+
 #endif //SCREEN_WORMS_EXCEPTIONS_H
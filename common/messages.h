@@ -1,12 +1,15 @@
 #ifndef SCREEN_WORMS_MESSAGES_H
 #define SCREEN_WORMS_MESSAGES_H
 
+#include <cstdint>
 #include <string>
 #include <cstring>
 #include <utility>
 #include <uv.h>
 #include "../utils/util_func.h"
+#include "../utils/wire.h"
 #include "events.h"
+#include "event_log.h"
 #include "const.h"
 
 using namespace std;
@@ -29,19 +32,58 @@ public:
             player_name(std::move(_player_name)) {}
 
     ClientToServerMsg(const char *buffer, size_t size) {
-        string msg(buffer, size);
-        session_id = deserialize64(msg.substr(0, sizeof(uint64_t)));
-        turn_direction = deserialize8(msg.substr(sizeof(uint64_t), 1));
-        next_expected_event_no = deserialize32(
-                msg.substr(sizeof(uint64_t) + 1, sizeof(uint32_t)));
-
-        size_t num_size = sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint64_t);
-        player_name = msg.substr(num_size, size - num_size);
+        ByteReader reader(buffer, size);
+        session_id = reader.read64();
+        turn_direction = reader.read8();
+        next_expected_event_no = reader.read32();
+        player_name = reader.read_rest();
     }
 
-    string serialize() {
-        return serialize64(session_id) + serialize8(turn_direction) +
-               serialize32(next_expected_event_no) + player_name;
+    void serialize(ByteWriter &writer) {
+        writer.write64(session_id);
+        writer.write8(turn_direction);
+        writer.write32(next_expected_event_no);
+        writer.write_bytes(player_name);
+    }
+};
+
+/* Single pass decoder of message sent from server to client. Events are decoded in place
+ * from the received datagram, one at a time. */
+class ServerMsgReader {
+private:
+    ByteReader reader;
+
+public:
+    uint32_t game_id{}; // 4 bajty, liczba bez znaku
+
+    ServerMsgReader(const char *buffer, size_t size) : reader(buffer, size) {
+        if (size > sizeof(uint32_t)) {
+            game_id = reader.read32();
+        }
+        else {
+            reader = ByteReader(buffer, 0);
+        }
+    }
+
+    /* Decodes next event of the message. Events of unknown type are skipped. Returns false
+     * if there are no more events or the rest of message is corrupted. */
+    bool next(EventView &event) {
+        while (!reader.empty()) {
+            try {
+                event = EventView::read(reader);
+                return true;
+            }
+            catch (UnknownEventTypeException &e) {
+                continue;
+            }
+            catch (IncorrectCrc32Exception &e) {
+                break;
+            }
+            catch (TruncatedMessageException &e) {
+                break;
+            }
+        }
+        return false;
     }
 };
 
@@ -51,62 +93,76 @@ public:
     uint32_t game_id{}; // 4 bajty, liczba bez znaku
     vector<Event> events; // zmienna liczba rekordów
     bool to_all = false; // message should be send to all clients
+    // Outgoing messages refer to events stored in the server's event log instead of holding
+    // their own copies. Events with numbers from first_event to last_event (exclusive)
+    // are sent.
+    const EventLog *log = nullptr;
+    size_t first_event = 0;
+    size_t last_event = 0;
+    // Datagrams of the message which are actually sent, events behind them are left for
+    // the client to request again.
+    size_t max_datagrams = SIZE_MAX;
+    // Leading datagrams which the client does not ask for again, so pacing must not drop
+    // them.
+    size_t whole_datagrams = 0;
 
     explicit ServerMsg() = default;
 
     ServerMsg(const char *buffer, size_t size) {
-        size_t len;
-        string msg(buffer, size);
-        Event event;
-
-        if (msg.size() > sizeof(uint32_t)) {
-            game_id = deserialize32(msg.substr(0, 4));
-            msg = msg.substr(4, msg.length() - 4);
-            while (!msg.empty()) {
-                len = deserialize32(msg.substr(0, 4)) + 2 * sizeof(uint32_t);
-                try {
-                    event = Event(msg.substr(0, len));
-                }
-                catch (IncorrectCrc32Exception &e) {
-                    return;
-                }
-                catch (UnknownEventTypeException &e) {
-                    msg = msg.substr(len, msg.length() - len);
-                    continue;
-                }
-                events.push_back(event);
-                msg = msg.substr(len, msg.length() - len);
-            }
+        ServerMsgReader reader(buffer, size);
+        EventView event;
+
+        game_id = reader.game_id;
+        while (reader.next(event)) {
+            events.emplace_back(event);
         }
     }
 
-    ServerMsg(uint32_t _game_id, const vector<Event> &_events, bool to_all = false) :
+    ServerMsg(uint32_t _game_id, const EventLog &_log, size_t _first_event,
+              size_t _last_event, bool to_all = false) :
             game_id(_game_id),
-            events(_events),
-            to_all(to_all) {}
+            to_all(to_all),
+            log(&_log),
+            first_event(_first_event),
+            last_event(_last_event) {}
 
     bool empty() {
-        return events.empty();
+        return events.empty() && first_event >= last_event;
     }
 
-    /* Divides events that should be sent into separate datagrams (serializes ServerMsg class)
-     * trying to put as many events as possible into single datagram. */
-    vector<string> get_datagrams() {
-        if (empty()) {
-            return vector<string>();
+    /* Writes datagram with game_id and as many events as possible, starting from event
+     * number next_event, into buffer of DATAGRAM_SIZE bytes. Events are copied from the log
+     * in their encoded form, nothing is serialized again. Moves next_event behind the last
+     * written event and returns size of the datagram. */
+    size_t write_datagram(size_t &next_event, char *buffer) {
+        ByteWriter writer(buffer, DATAGRAM_SIZE);
+        writer.write32(game_id);
+        size_t first_written = next_event;
+        while (next_event < last_event) {
+            size_t len = log->length(next_event);
+            if (len > writer.remaining()) {
+                if (next_event == first_written) { // Would not fit into any datagram.
+                    ++next_event;
+                    continue;
+                }
+                break;
+            }
+            writer.write_bytes(log->data(next_event), len);
+            ++next_event;
         }
+        return writer.size();
+    }
 
+    /* Divides events that should be sent into separate datagrams trying to put as many
+     * events as possible into single datagram, at most max_datagrams of them. */
+    vector<string> get_datagrams() {
         vector<string> answers;
-        string game_id_serialized = serialize32(game_id);
-        answers.push_back(game_id_serialized);
-        for (auto &event: events) {
-            string event_str = event.serialize();
-            if (event_str.length() > DATAGRAM_SIZE - answers.back().length()) {
-                answers.push_back(game_id_serialized);
-            }
-            answers.back().append(event_str);
+        char buffer[DATAGRAM_SIZE];
+        size_t next_event = first_event;
+        while (next_event < last_event && answers.size() < max_datagrams) {
+            size_t len = write_datagram(next_event, buffer);
+            answers.emplace_back(buffer, len);
         }
-
         return answers;
     }
 };
@@ -0,0 +1,49 @@
+#ifndef SCREEN_WORMS_BOARD_H
+#define SCREEN_WORMS_BOARD_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+/* Bitmap of eaten pixels stored row-major in 64-bit words. Memory is kept between games,
+ * resetting board of the same size only clears the words. */
+class Board {
+private:
+    vector<uint64_t> words;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    size_t bit_index(uint32_t x, uint32_t y) const {
+        return (size_t) y * width + x;
+    }
+
+public:
+    Board() = default;
+
+    /* Prepares empty board of given size. */
+    void reset(uint32_t _width, uint32_t _height) {
+        width = _width;
+        height = _height;
+        size_t word_count = ((size_t) width * height + 63) / 64;
+        if (words.size() == word_count) {
+            memset(words.data(), 0, word_count * sizeof(uint64_t));
+        }
+        else {
+            words.assign(word_count, 0);
+        }
+    }
+
+    bool is_eaten(uint32_t x, uint32_t y) const {
+        size_t i = bit_index(x, y);
+        return (words[i / 64] >> (i % 64)) & 1;
+    }
+
+    void eat(uint32_t x, uint32_t y) {
+        size_t i = bit_index(x, y);
+        words[i / 64] |= (uint64_t) 1 << (i % 64);
+    }
+};
+
+#endif //SCREEN_WORMS_BOARD_H
@@ -0,0 +1,296 @@
+#ifndef SCREEN_WORMS_DATAGRAM_IO_H
+#define SCREEN_WORMS_DATAGRAM_IO_H
+
+#include <cerrno>
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include "../common/const.h"
+#include "../utils/metrics.h"
+
+#define IO_BATCH_SIZE 64
+#define GSO_MAX_SEGMENTS 64 // Kernel limit of datagrams in a single segmented send
+#define GSO_MAX_BYTES 65000 // Segmented send must fit into a single IP packet
+#define GSO_CONTROL_SIZE CMSG_SPACE(sizeof(uint16_t))
+
+using namespace std;
+
+/* Counters of socket operations. Tick is a single pass of the server loop. Written by the
+ * thread using the I/O layer, may be read by any. */
+class IoStats {
+public:
+    Counter syscalls;
+    Counter datagrams_in;
+    Counter datagrams_out;
+    Counter gso_sends; // Sends carrying several datagrams segmented by the kernel
+    Counter ticks;
+};
+
+enum IoBackend {
+    IO_MMSG,
+    IO_URING,
+};
+
+inline bool same_destination(const sockaddr_in6 &left, const sockaddr_in6 &right) {
+    return left.sin6_port == right.sin6_port
+           && memcmp(&left.sin6_addr, &right.sin6_addr, sizeof(in6_addr)) == 0;
+}
+
+/* Batched datagram I/O on a single UDP socket. Incoming datagrams are read in batches of
+ * up to IO_BATCH_SIZE. Outgoing datagrams are queued during a tick and sent together on
+ * flush. Datagram content is written once into a buffer reused between ticks, even if it
+ * is queued for many clients. How the socket is read and written is up to the backend.
+ *
+ * If the kernel supports UDP_SEGMENT, consecutive datagrams queued for the same client
+ * are sent as one buffer which the kernel cuts into datagrams of the first one's size.
+ * Such a run may therefore only end with a shorter datagram. */
+class DatagramIo {
+protected:
+    int sock = -1;
+
+    vector<char> payloads; // Content of datagrams of current tick, DATAGRAM_SIZE bytes each
+    vector<size_t> payload_lengths;
+    vector<pair<size_t, sockaddr_in6>> queued; // Payload index and destination
+    size_t egress_used = 0; // Bytes queued in current tick
+    bool gso = false; // Kernel segments sends, cleared if it turns out it cannot
+
+    /* Returns number of queued datagrams starting from first which can be sent together
+     * as a single segmented send. */
+    size_t segment_run(size_t first) const {
+        if (!gso) {
+            return 1;
+        }
+        size_t size = payload_lengths[queued[first].first], count = 1;
+        while (first + count < queued.size() && count < GSO_MAX_SEGMENTS
+               && (count + 1) * size <= GSO_MAX_BYTES) {
+            const pair<size_t, sockaddr_in6> &next = queued[first + count];
+            if (!same_destination(next.second, queued[first].second)
+                || payload_lengths[next.first] > size) {
+                break;
+            }
+            ++count;
+            if (payload_lengths[next.first] < size) {
+                break;
+            }
+        }
+        return count;
+    }
+
+    /* Prepares message header sending count queued datagrams starting from first, with
+     * segment size passed in control if there are more of them. Needs count iovecs. */
+    void prepare_send(size_t first, size_t count, msghdr &hdr, iovec *iovs, char *control) {
+        for (size_t i = 0; i < count; ++i) {
+            size_t payload = queued[first + i].first;
+            iovs[i].iov_base = &payloads[payload * DATAGRAM_SIZE];
+            iovs[i].iov_len = payload_lengths[payload];
+        }
+        memset(&hdr, 0, sizeof(msghdr));
+        hdr.msg_name = &queued[first].second;
+        hdr.msg_namelen = sizeof(sockaddr_in6);
+        hdr.msg_iov = iovs;
+        hdr.msg_iovlen = count;
+        if (count > 1) {
+            hdr.msg_control = control;
+            hdr.msg_controllen = GSO_CONTROL_SIZE;
+            cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            auto segment_size = (uint16_t) iovs[0].iov_len;
+            memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(uint16_t));
+        }
+    }
+
+    /* Returns true if segmented send failed with given error because the kernel could not
+     * segment it, so its datagrams should be sent again one by one. EIO means the device
+     * cannot checksum segments, which never changes, so segmentation is turned off for good.
+     * EINVAL means a segment does not fit into the path MTU of this destination only. */
+    bool cannot_segment(int error) {
+        if (error == EIO) {
+            gso = false;
+            return true;
+        }
+        return error == EINVAL;
+    }
+
+    /* Forgets datagrams of the tick which has just been sent. */
+    void end_tick() {
+        payload_lengths.clear();
+        queued.clear();
+        egress_used = 0;
+        ++stats.ticks;
+    }
+
+public:
+    IoStats stats;
+    size_t egress_budget = SIZE_MAX; // Bytes which may be sent in a single tick
+
+    virtual ~DatagramIo() = default;
+
+    /* Sets socket used by the I/O layer. If receiving is false the socket is only written,
+     * datagrams are read from it by somebody else. */
+    virtual void attach(int _sock, bool receiving) {
+        (void) receiving;
+        sock = _sock;
+        int segment_size;
+        socklen_t size = sizeof(segment_size);
+        gso = getsockopt(sock, SOL_UDP, UDP_SEGMENT, &segment_size, &size) == 0;
+    }
+
+    /* Returns descriptor which becomes readable when receive may return datagrams. */
+    virtual int wait_fd() const {
+        return sock;
+    }
+
+    /* Reads as many waiting datagrams as fit into one batch without blocking. Returns
+     * number of datagrams read, they stay available until next call. */
+    virtual size_t receive() = 0;
+
+    virtual const char *data(size_t i) const = 0;
+
+    virtual size_t length(size_t i) const = 0;
+
+    virtual const sockaddr_in6 &address(size_t i) const = 0;
+
+    /* Returns buffer of DATAGRAM_SIZE bytes for content of next datagram. Buffer is valid
+     * until next call. */
+    char *new_payload() {
+        size_t offset = payload_lengths.size() * DATAGRAM_SIZE;
+        if (payloads.size() < offset + DATAGRAM_SIZE) {
+            payloads.resize(offset + DATAGRAM_SIZE);
+        }
+        return &payloads[offset];
+    }
+
+    /* Stores datagram written into the buffer returned by new_payload to be sent during next
+     * flush and returns its handle. */
+    size_t commit_payload(size_t length) {
+        payload_lengths.push_back(length);
+        return payload_lengths.size() - 1;
+    }
+
+    const char *payload(size_t handle) const {
+        return &payloads[handle * DATAGRAM_SIZE];
+    }
+
+    size_t payload_length(size_t handle) const {
+        return payload_lengths[handle];
+    }
+
+    /* Returns number of datagrams stored in current tick. */
+    size_t payload_count() const {
+        return payload_lengths.size();
+    }
+
+    /* Queues stored datagram to be sent to given address during next flush. */
+    void queue(size_t payload, const sockaddr_in6 &addr) {
+        queued.emplace_back(payload, addr);
+        egress_used += payload_lengths[payload];
+    }
+
+    /* Returns true if datagram of given length still fits into egress budget of current
+     * tick. */
+    bool within_budget(size_t length) const {
+        return egress_used + length <= egress_budget;
+    }
+
+    /* Sends all queued datagrams and ends current tick. Datagrams which could not be sent
+     * are dropped, as they would be by the network. */
+    virtual void flush() = 0;
+};
+
+/* Backend reading with recvmmsg and writing with sendmmsg, one system call per batch. */
+class MmsgIo : public DatagramIo {
+private:
+    vector<char> rcv_buffers;
+    vector<sockaddr_in6> rcv_addrs;
+    vector<iovec> rcv_iovs;
+    vector<mmsghdr> rcv_msgs;
+
+    vector<iovec> snd_iovs;
+    vector<mmsghdr> snd_msgs;
+    vector<char> snd_controls;
+    vector<size_t> snd_segments; // Datagrams carried by each message
+
+public:
+    MmsgIo() :
+            rcv_buffers(IO_BATCH_SIZE * DATAGRAM_SIZE),
+            rcv_addrs(IO_BATCH_SIZE),
+            rcv_iovs(IO_BATCH_SIZE),
+            rcv_msgs(IO_BATCH_SIZE),
+            snd_iovs(IO_BATCH_SIZE * GSO_MAX_SEGMENTS),
+            snd_msgs(IO_BATCH_SIZE),
+            snd_controls(IO_BATCH_SIZE * GSO_CONTROL_SIZE),
+            snd_segments(IO_BATCH_SIZE) {}
+
+    size_t receive() override {
+        for (size_t i = 0; i < IO_BATCH_SIZE; ++i) {
+            rcv_iovs[i].iov_base = &rcv_buffers[i * DATAGRAM_SIZE];
+            rcv_iovs[i].iov_len = DATAGRAM_SIZE;
+            memset(&rcv_msgs[i], 0, sizeof(mmsghdr));
+            rcv_msgs[i].msg_hdr.msg_name = &rcv_addrs[i];
+            rcv_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in6);
+            rcv_msgs[i].msg_hdr.msg_iov = &rcv_iovs[i];
+            rcv_msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        ++stats.syscalls;
+        int ret = recvmmsg(sock, rcv_msgs.data(), IO_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+        if (ret <= 0) {
+            return 0;
+        }
+        stats.datagrams_in += ret;
+        return ret;
+    }
+
+    const char *data(size_t i) const override {
+        return &rcv_buffers[i * DATAGRAM_SIZE];
+    }
+
+    size_t length(size_t i) const override {
+        return rcv_msgs[i].msg_len;
+    }
+
+    const sockaddr_in6 &address(size_t i) const override {
+        return rcv_addrs[i];
+    }
+
+    void flush() override {
+        size_t sent = 0, unsegmented = 0; // Datagrams before unsegmented are sent one by one
+        while (sent < queued.size()) {
+            size_t batch = 0, next = sent, iovs = 0;
+            for (; batch < IO_BATCH_SIZE && next < queued.size(); ++batch) {
+                snd_segments[batch] = next < unsegmented ? 1 : segment_run(next);
+                prepare_send(next, snd_segments[batch], snd_msgs[batch].msg_hdr,
+                             &snd_iovs[iovs], &snd_controls[batch * GSO_CONTROL_SIZE]);
+                snd_msgs[batch].msg_len = 0;
+                next += snd_segments[batch];
+                iovs += snd_segments[batch];
+            }
+
+            ++stats.syscalls;
+            int ret = sendmmsg(sock, snd_msgs.data(), batch, 0);
+            if (ret <= 0) {
+                if (snd_segments[0] > 1 && cannot_segment(errno)) {
+                    unsegmented = sent + snd_segments[0];
+                }
+                else { // First message of the batch failed, skip it.
+                    sent += snd_segments[0];
+                }
+                continue;
+            }
+            for (int i = 0; i < ret; ++i) {
+                sent += snd_segments[i];
+                stats.datagrams_out += snd_segments[i];
+                stats.gso_sends += snd_segments[i] > 1;
+            }
+        }
+        end_tick();
+    }
+};
+
+#endif //SCREEN_WORMS_DATAGRAM_IO_H
@@ -0,0 +1,82 @@
+#ifndef SCREEN_WORMS_DIRECTIONS_H
+#define SCREEN_WORMS_DIRECTIONS_H
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+#define DIRECTIONS 360
+
+using namespace std;
+
+/* Distance a worm moves along each axis during one round. */
+class Step {
+public:
+    double dx;
+    double dy;
+};
+
+// Parts of pi / 2, each with few enough bits for k * part to be exact in long double for
+// k <= 4.
+constexpr long double HALF_PI_1 = 1.570796326734125614166259765625000000L;
+constexpr long double HALF_PI_2 = 6.077100506303965976595549136618501507e-11L;
+constexpr long double HALF_PI_3 = 2.022266248795950732376519042844277274e-21L;
+
+/* Series for sin and cos of x, |x| <= pi / 4. */
+constexpr long double series_sin(long double x) {
+    long double term = x, sum = x;
+    for (int n = 1; n < 14; ++n) {
+        term *= -x * x / ((2 * n) * (2 * n + 1));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr long double series_cos(long double x) {
+    long double term = 1, sum = 1;
+    for (int n = 1; n < 14; ++n) {
+        term *= -x * x / ((2 * n - 1) * (2 * n));
+        sum += term;
+    }
+    return sum;
+}
+
+/* Returns cos and sin of the double direction / 180.0 * M_PI rounded to nearest. Angle is
+ * reduced to [-pi/4, pi/4] by a multiple of pi/2 in three exact steps, then series are
+ * summed in long double, leaving enough precision to round the results correctly. */
+constexpr Step direction_step(int direction) {
+    double angle = ((double) direction) / 180.0 * M_PI;
+    auto quadrant = (int) (angle / 1.5707963267948966 + 0.5);
+    long double r = (((long double) angle - quadrant * HALF_PI_1) - quadrant * HALF_PI_2)
+                    - quadrant * HALF_PI_3;
+    long double s = series_sin(r), c = series_cos(r);
+    switch (quadrant % 4) {
+        case 0:
+            return Step{(double) c, (double) s};
+        case 1:
+            return Step{(double) -s, (double) c};
+        case 2:
+            return Step{(double) -c, (double) -s};
+        default:
+            return Step{(double) s, (double) -c};
+    }
+}
+
+constexpr array<Step, DIRECTIONS> direction_steps() {
+    array<Step, DIRECTIONS> steps{};
+    for (int direction = 0; direction < DIRECTIONS; ++direction) {
+        steps[direction] = direction_step(direction);
+    }
+    // Exact sine of this angle lies 0.004 ulp from the midpoint between two doubles and
+    // glibc rounds it to the farther one. Its value is kept, so games replay exactly as on
+    // servers which called sin().
+    steps[297].dy = -0x1.c83201d3d2c6ep-1;
+    return steps;
+}
+
+/* Steps for every direction in whole degrees, generated at compile time. Entry for direction
+ * d holds what the server used to compute with glibc every round, so movement is unchanged
+ * but no longer depends on the math library of the platform. */
+constexpr array<Step, DIRECTIONS> STEPS = direction_steps();
+
+#endif //SCREEN_WORMS_DIRECTIONS_H
@@ -1,13 +1,17 @@
 #include <map>
 #include <utility>
 #include <algorithm>
-#include <cmath>
 #include "../common/exceptions.h"
 #include "../common/events.h"
 #include "../common/messages.h"
 #include "../utils/timer.h"
+#include "../utils/tick_scheduler.h"
 #include "../utils/rng.h"
 #include "../utils/id_manager.h"
+#include "board.h"
+#include "snapshot.h"
+#include "worms.h"
+#include "worker_metrics.h"
 
 #define MIN_SEED 0
 #define MAX_SEED UINT32_MAX
@@ -19,18 +23,23 @@
 #define MAX_WIDTH 2560
 #define MIN_HEIGHT 16
 #define MAX_HEIGHT 1440
-#define SECOND_MILLIS 1000
-
+#define MIN_SNAPSHOT_EVENTS 0
+#define MAX_SNAPSHOT_EVENTS UINT32_MAX
+#define MIN_RETRANSMIT_DATAGRAMS 1
+#define MAX_RETRANSMIT_DATAGRAMS 65536
+#define MIN_CATCH_UP 1
+#define MAX_CATCH_UP 250
+#define SECOND_NANOS 1000000000
+
+/* Player state which does not change every round. Position and direction of the player's
+ * worm are kept in Worms under player number. */
 class PlayerData {
 public:
     uint8_t number{};
     string name;
-    double x{};
-    double y{};
-    int32_t move_direction{};
     uint8_t turn_direction{};
     bool disconnected = false;
-    bool playing = false;
+    bool in_game = false; // Has a worm in current game, possibly already eliminated
     bool ready = false;
     Timer timer;
 
@@ -45,37 +54,75 @@ class GameState {
 public:
     bool started = false;
     uint32_t game_id{};
-    vector<Event> events;
-    vector<vector<bool>> eaten_pixels; // True if pixel eaten
+    EventLog events; // Events in wire format, shared by all answers
+    Board eaten_pixels; // Bit set if pixel eaten
     uint32_t first_not_reported_event = 0;
+    size_t snapshot_min_events = 0; // Missing events answered with snapshot, 0 - never
+    size_t retransmit_datagrams = 16; // Datagrams of missing events sent in one answer
+    BoardSnapshot snapshot;
 
     GameState() = default;
 
-    GameState(uint32_t id, uint32_t width, uint32_t height) :
-            started(true),
-            game_id(id),
-            events(),
-            eaten_pixels(width, vector<bool>(height, false)) {}
-
-    void add_event(Event &event) {
-        event.event_no = events.size();
-        events.push_back(event);
+    /* Starts new game with given id. Memory used by the previous game's event log and
+     * board is reused. */
+    void reset(uint32_t id, uint32_t width, uint32_t height) {
+        started = true;
+        game_id = id;
+        events.clear();
+        eaten_pixels.reset(width, height);
+        first_not_reported_event = 0;
+        snapshot.reset();
     }
 
     size_t get_last_event_num() {
         if (events.empty()) {
             return 0;
         }
-        return events.back().event_no;
+        return events.size() - 1;
     }
 
-    /* Returns all missing events starting from next_expected_event_no. */
-    vector<Event> get_missing_events(size_t next_exp_event_no) {
+    /* Returns message with all missing events starting from next_expected_event_no. */
+    ServerMsg get_missing_events(size_t next_exp_event_no) {
         if (next_exp_event_no == first_not_reported_event || first_not_reported_event == 0) {
-            return vector<Event>();
+            return ServerMsg();
         }
-        return vector<Event>(events.begin() + next_exp_event_no, events.end());
+        return get_catch_up(next_exp_event_no);
     };
+
+    /* Returns message with events a client expecting event next_exp_event_no misses. If
+     * there are more than snapshot_min_events of them, the client gets a snapshot of the
+     * board and events following it instead. */
+    ServerMsg get_catch_up(size_t next_exp_event_no) {
+        if (snapshot_min_events == 0 || next_exp_event_no >= events.size()
+            || events.size() - next_exp_event_no <= snapshot_min_events) {
+            return get_events_from(next_exp_event_no);
+        }
+        const EventLog *catch_up = snapshot.update(events);
+        if (catch_up == nullptr || next_exp_event_no >= snapshot.covered_events()) {
+            return get_events_from(next_exp_event_no);
+        }
+        // Client which already knows the game does not need NEW_GAME again. Snapshot is
+        // sent whole and bounded by SNAPSHOT_MAX_PARTS. Client which misses some of its
+        // parts keeps expecting the same event, so it gets the snapshot again. Events
+        // following it are cut to retransmit_datagrams as in other answers.
+        size_t first = next_exp_event_no == 0 ? 0 : 1;
+        ServerMsg msg(game_id, *catch_up, first, catch_up->size());
+        msg.whole_datagrams = snapshot.head_size() - first;
+        msg.max_datagrams = msg.whole_datagrams + retransmit_datagrams;
+        return msg;
+    }
+
+    /* Returns message with all events starting from given event number. Answer to a
+     * single client is cut to retransmit_datagrams, a client further behind gets the
+     * rest in answers to its following messages. */
+    ServerMsg get_events_from(size_t first_event_no, bool to_all = false) {
+        ServerMsg msg(game_id, events, min(first_event_no, events.size()), events.size(),
+                      to_all);
+        if (!to_all) {
+            msg.max_datagrams = retransmit_datagrams;
+        }
+        return msg;
+    }
 };
 
 class GameManager {
@@ -84,23 +131,20 @@ private:
         return 0 <= x && x < width && 0 <= y && y < height;
     }
 
-    ServerMsg create_server_msg(const vector<Event> &events) {
-        return ServerMsg(game_state.game_id, events);
-    }
-
     /* Creates message to all players with all events that were not reported so far. */
     ServerMsg create_server_msg_to_all() {
-        vector<Event> &events = game_state.events;
         uint32_t first_to_report = game_state.first_not_reported_event;
-        game_state.first_not_reported_event = events.size();
-        return ServerMsg(game_state.game_id,
-                         vector<Event>(events.begin() + first_to_report, events.end()), true);
+        game_state.first_not_reported_event = game_state.events.size();
+        if (metrics != nullptr) {
+            metrics->events += game_state.events.size() - first_to_report;
+        }
+        return game_state.get_events_from(first_to_report, true);
     }
 
-    /* Creates new game_stete object. Generates new game event and adds it to stored events.
-     * Starts round timer. */
+    /* Resets game state for a new game. Generates new game event and adds it to stored
+     * events. Starts round schedule. */
     void generate_new_game() {
-        game_state = GameState(rng.get_random(), width, height);
+        game_state.reset(rng.get_random(), width, height);
         playing = ready;
         ready = 0;
 
@@ -110,27 +154,24 @@ private:
             PlayerData &player = iter.second;
             names.push_back(player.name);
         }
-        NewGameData data(width, height, names);
-        Event event = Event(NEW_GAME, make_shared<NewGameData>(data));
-        game_state.add_event(event);
-        timer.start();
+        game_state.events.append_new_game(width, height, names);
+        scheduler.start(chrono::nanoseconds(SECOND_NANOS / rounds_per_sec));
+        if (metrics != nullptr) {
+            ++metrics->games;
+        }
     }
 
     /* Generates event player eliminated and adds it to stored events. */
-    void generate_player_eliminated(PlayerData &player) {
+    void generate_player_eliminated(uint8_t player_num) {
         --playing;
-        player.playing = false;
-        PlayerEliminatedData data(player.number);
-        Event event = Event(PLAYER_ELIMINATED, make_shared<PlayerEliminatedData>(data));
-        game_state.add_event(event);
+        worms.alive[player_num] = false;
+        game_state.events.append_player_eliminated(player_num);
     }
 
     /* Generates event pixel and adds it to stored events. */
     void generate_pixel(uint8_t player_num, uint32_t x, uint32_t y) {
-        game_state.eaten_pixels[x][y] = true;
-        PixelData data(player_num, x, y);
-        Event event = Event(PIXEL, make_shared<PixelData>(data));
-        game_state.add_event(event);
+        game_state.eaten_pixels.eat(x, y);
+        game_state.events.append_pixel(player_num, x, y);
     }
 
     /* Generates event game over and adds it to stored events. Ends current game and removes
@@ -143,7 +184,7 @@ private:
         auto iter = players_data.begin();
         while (iter != players_data.end()) {
             PlayerData &player = iter->second;
-            player.playing = false;
+            player.in_game = false;
             if (player.disconnected) {
                 auto to_erase = iter;
                 ++iter;
@@ -154,9 +195,7 @@ private:
             }
         }
 
-        GameOverData data;
-        Event event = Event(GAME_OVER, make_shared<GameOverData>(data));
-        game_state.add_event(event);
+        game_state.events.append_game_over();
     }
 
     /* Generates new game and initializes players information possibly generating
@@ -165,19 +204,23 @@ private:
         generate_new_game();
 
         IdManager id_manager;
+        worms.reset(players_data.size());
         for (auto &iter: players_data) {
             PlayerData &player = iter.second;
             player.ready = false;
-            player.playing = true;
+            player.in_game = true;
             player.number = id_manager.get_next_id();
-            player.x = (rng.get_random() % width) + 0.5;
-            player.y = (rng.get_random() % height) + 0.5;
-            player.move_direction = rng.get_random() % 360;
-            if (game_state.eaten_pixels[player.x][player.y]) {
-                generate_player_eliminated(player);
+            uint8_t num = player.number;
+            worms.alive[num] = true;
+            worms.turn[num] = player.turn_direction;
+            worms.x[num] = (rng.get_random() % width) + 0.5;
+            worms.y[num] = (rng.get_random() % height) + 0.5;
+            worms.direction[num] = rng.get_random() % 360;
+            if (game_state.eaten_pixels.is_eaten(worms.x[num], worms.y[num])) {
+                generate_player_eliminated(num);
             }
             else {
-                generate_pixel(player.number, player.x, player.y);
+                generate_pixel(num, worms.x[num], worms.y[num]);
             }
         }
 
@@ -198,14 +241,45 @@ private:
         }
 
         if (game_state.started) {
-            return create_server_msg(game_state.events);
+            return game_state.get_catch_up(0);
         }
         else {
             if (ready >= 2 && ready == players_data.size()) { // Game ready to start.
                 return new_game();
             }
             else {
-                return create_server_msg(game_state.events);
+                return game_state.get_catch_up(0);
+            }
+        }
+    }
+
+    /* Performs single round. All worms are turned and moved at once first. Then worms which
+     * entered a new pixel are checked one after another in player number order, so a worm
+     * runs into pixels eaten earlier in the same round and nothing is checked after game
+     * over. */
+    void play_round() {
+        if (metrics != nullptr) {
+            ++metrics->rounds;
+        }
+        worms.turn_all(turning_speed);
+        worms.advance_all();
+
+        for (uint32_t num = 0; num < worms.count; ++num) {
+            if (!worms.alive[num] || !worms.moved[num]) {
+                continue;
+            }
+
+            auto curr_x = (int64_t) worms.x[num], curr_y = (int64_t) worms.y[num];
+            if (!is_on_board(worms.x[num], worms.y[num])
+                || game_state.eaten_pixels.is_eaten(curr_x, curr_y)) {
+                generate_player_eliminated(num);
+                if (playing < 2) {
+                    generate_game_over();
+                    break;
+                }
+            }
+            else {
+                generate_pixel(num, curr_x, curr_y);
             }
         }
     }
@@ -218,9 +292,11 @@ public:
     uint32_t height = 480;
     GameState game_state = GameState();
     map<string, PlayerData> players_data;
+    Worms worms;
     uint32_t ready = 0;
     uint32_t playing = 0;
-    Timer timer;
+    TickScheduler scheduler;
+    GameMetrics *metrics = nullptr; // Nothing is recorded if not set
 
     void set_turning_speed(int64_t _turning_speed) {
         check_limits(_turning_speed, MIN_TURNING_SPEED, MAX_TURNING_SPEED, "Turning speed");
@@ -243,6 +319,27 @@ public:
         height = _height;
     }
 
+    void set_max_catch_up(int64_t _max_catch_up) {
+        check_limits(_max_catch_up, MIN_CATCH_UP, MAX_CATCH_UP, "Max catch up");
+        scheduler.max_catch_up = _max_catch_up;
+    }
+
+    /* Snapshots are sent as SNAPSHOT events, which clients built before them do not know.
+     * Such a client drops the snapshot and then counts the events following it as the ones
+     * it expected, so it never shows the board the snapshot describes. Snapshots should
+     * only be enabled when all clients understand them. */
+    void set_snapshot_min_events(int64_t _snapshot_min_events) {
+        check_limits(_snapshot_min_events, MIN_SNAPSHOT_EVENTS, MAX_SNAPSHOT_EVENTS,
+                     "Snapshot min events");
+        game_state.snapshot_min_events = _snapshot_min_events;
+    }
+
+    void set_retransmit_datagrams(int64_t _retransmit_datagrams) {
+        check_limits(_retransmit_datagrams, MIN_RETRANSMIT_DATAGRAMS, MAX_RETRANSMIT_DATAGRAMS,
+                     "Retransmit datagrams");
+        game_state.retransmit_datagrams = _retransmit_datagrams;
+    }
+
     void set_rng(int64_t seed) {
         check_limits(seed, MIN_SEED, MAX_SEED, "Seed");
         rng = Rng(seed);
@@ -255,6 +352,9 @@ public:
         if (iter != players_data.end()) { // Not observer
             PlayerData &player = iter->second;
             player.turn_direction = msg.turn_direction;
+            if (player.in_game) {
+                worms.turn[player.number] = msg.turn_direction;
+            }
             if (!game_state.started && msg.turn_direction > 0 && !player.ready) {
                 player.ready = true;
                 ++ready;
@@ -265,14 +365,12 @@ public:
                 return new_game();
             }
             else if (game_state.get_last_event_num() >= msg.next_expected_event_no) {
-                return create_server_msg(
-                        game_state.get_missing_events(msg.next_expected_event_no));
+                return game_state.get_missing_events(msg.next_expected_event_no);
             }
         }
         else { // Observer
             if (game_state.get_last_event_num() >= msg.next_expected_event_no) {
-                return create_server_msg(
-                        game_state.get_missing_events(msg.next_expected_event_no));
+                return game_state.get_missing_events(msg.next_expected_event_no);
             }
         }
         return ServerMsg();
@@ -281,10 +379,14 @@ public:
     /* Add new player or send events to new observer. */
     ServerMsg new_participant(const ClientToServerMsg &msg, const string &name) {
         if (msg.player_name.empty()) { // Observer - send game history.
-            return create_server_msg(
-                    game_state.get_missing_events(msg.next_expected_event_no));
+            return game_state.get_missing_events(msg.next_expected_event_no);
         }
         else { // Player
+            auto iter = players_data.find(name);
+            if (iter != players_data.end() && iter->second.in_game) {
+                // Worm of replaced player stops without being eliminated.
+                worms.alive[iter->second.number] = false;
+            }
             players_data[name] = PlayerData(msg.player_name);
             return new_player(msg, name);
         }
@@ -303,53 +405,61 @@ public:
         }
     }
 
-    /* Performs next round actions (calculates players movements) if certain time has passed.
-     * Ends game when game over event appears. Calculated events are put into message
-     * directed to every connected participant. */
-    ServerMsg cyclic_activities() {
-        // Game has't started yet or started but we should still wait.
-        if (!game_state.started || !timer.timeout(SECOND_MILLIS / rounds_per_sec)) {
-            return ServerMsg();
-        }
-
+    /* Adds connected players to counts of their states. */
+    void count_players(uint64_t *states) const {
         for (auto &iter: players_data) {
-            PlayerData &player = iter.second;
-            if (player.playing) {
-                if (player.turn_direction == 1) {
-                    player.move_direction = (player.move_direction + turning_speed) % 360;
-                }
-                else if (player.turn_direction == 2) {
-                    player.move_direction =
-                            (player.move_direction - (int32_t) turning_speed) % 360;
-                    if (player.move_direction < 0) {
-                        player.move_direction += 360;
-                    }
-                }
-                Coord old = Coord(player.x, player.y);
-                player.x += cos(((double) player.move_direction) / 180.0 * M_PI);
-                player.y += sin(((double) player.move_direction) / 180.0 * M_PI);
-
-                int64_t old_x = old.first, old_y = old.second,
-                        curr_x = player.x, curr_y = player.y;
-                if (old_x == curr_x && old_y == curr_y) {
-                    continue;
-                }
-
-                if (!is_on_board(player.x, player.y)
-                    || game_state.eaten_pixels[curr_x][curr_y]) {
-                    generate_player_eliminated(player);
-                    if (playing < 2) {
-                        generate_game_over();
-                        break;
-                    }
-                }
-                else {
-                    generate_pixel(player.number, curr_x, curr_y);
-                }
+            const PlayerData &player = iter.second;
+            if (player.disconnected) {
+                continue;
+            }
+            if (game_state.started && player.in_game) {
+                ++states[CLIENT_PLAYING];
+            }
+            else {
+                ++states[player.ready ? CLIENT_READY : CLIENT_WAITING];
             }
         }
+    }
 
-        timer.start();
+    /* Returns time left until next round should be performed or maximal duration if game
+     * is not running. */
+    chrono::nanoseconds time_to_next_round() {
+        if (!game_state.started) {
+            return chrono::nanoseconds::max();
+        }
+        return scheduler.time_left();
+    }
+
+    /* Performs given number of rounds at once, regardless of the schedule, stopping early
+     * if the game ends. Calculated events are put into message directed to every
+     * connected participant. */
+    ServerMsg run_rounds(uint32_t rounds) {
+        if (!game_state.started) {
+            return ServerMsg();
+        }
+        for (uint32_t round = 0; round < rounds && game_state.started; ++round) {
+            play_round();
+        }
         return create_server_msg_to_all();
     }
+
+    /* Performs rounds which are due (calculates players movements). Usually it is one round,
+     * after a stall the scheduler may ask for several which are then run back to back. Ends
+     * game when game over event appears. */
+    ServerMsg cyclic_activities() {
+        // Game has't started yet or started but we should still wait.
+        if (!game_state.started) {
+            return ServerMsg();
+        }
+        uint64_t skipped = scheduler.stats.skipped_ticks;
+        uint32_t rounds = scheduler.due_ticks();
+        if (rounds == 0) {
+            return ServerMsg();
+        }
+        if (metrics != nullptr) {
+            metrics->round_lateness.record(scheduler.stats.last_lateness.count());
+            metrics->skipped_rounds += scheduler.stats.skipped_ticks - skipped;
+        }
+        return run_rounds(rounds);
+    }
 };
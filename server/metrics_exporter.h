@@ -0,0 +1,242 @@
+#ifndef SCREEN_WORMS_METRICS_EXPORTER_H
+#define SCREEN_WORMS_METRICS_EXPORTER_H
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../utils/util_func.h"
+#include "../utils/metrics.h"
+#include "datagram_io.h"
+#include "worker.h"
+#include "worker_metrics.h"
+
+#define METRICS_PREFIX "screen_worms_"
+#define METRICS_REQUEST_MILLIS 100 // How long a connected client may take to send a request
+#define METRICS_REQUEST_SIZE 1024
+
+using namespace std;
+
+/* Publishes metrics of all workers in the text format of Prometheus. They are written to
+ * standard error on SIGUSR1 and, if a path is given, served to everybody who connects to a
+ * Unix domain socket, which is reachable from the local host only. Client which sends an
+ * HTTP request gets an HTTP response, anybody else just the metrics. Exporter runs in its
+ * own thread and only reads metrics kept by workers in relaxed atomics, so it never stops
+ * or slows them down. */
+class MetricsExporter {
+private:
+    vector<const Worker *> workers;
+    const DatagramIo *dispatcher_io; // Null if workers read their sockets themselves
+    int listen_fd = -1;
+    int signal_fd = -1;
+
+    static string worker_label(size_t worker) {
+        return "worker=\"" + to_string(worker) + "\"";
+    }
+
+    /* Writes metric with a single value for every worker. */
+    template<typename Value>
+    void per_worker(MetricsWriter &writer, const string &name, const string &type,
+                    const string &help, Value value) const {
+        writer.describe(METRICS_PREFIX + name, type, help);
+        for (size_t i = 0; i < workers.size(); ++i) {
+            writer.sample(METRICS_PREFIX + name, worker_label(i),
+                          value(workers[i]->get_metrics()));
+        }
+    }
+
+    /* Writes counter of I/O layer of every worker and of the dispatcher. */
+    void io_counter(MetricsWriter &writer, const string &name, const string &help,
+                    Counter IoStats::*counter) const {
+        writer.describe(METRICS_PREFIX + name, "counter", help);
+        for (size_t i = 0; i < workers.size(); ++i) {
+            writer.sample(METRICS_PREFIX + name, worker_label(i),
+                          (workers[i]->io_stats().*counter).load());
+        }
+        if (dispatcher_io != nullptr) {
+            writer.sample(METRICS_PREFIX + name, "worker=\"dispatcher\"",
+                          (dispatcher_io->stats.*counter).load());
+        }
+    }
+
+    void summaries(MetricsWriter &writer) const {
+        string name = METRICS_PREFIX "tick_duration_seconds";
+        writer.describe(name, "summary", "Time of a single pass of the worker loop.");
+        for (size_t i = 0; i < workers.size(); ++i) {
+            writer.summary(name, worker_label(i), workers[i]->get_metrics().tick_duration);
+        }
+        name = METRICS_PREFIX "round_lateness_seconds";
+        writer.describe(name, "summary", "Delay of rounds behind their deadlines.");
+        for (size_t i = 0; i < workers.size(); ++i) {
+            writer.summary(name, worker_label(i), workers[i]->get_metrics().game.round_lateness);
+        }
+    }
+
+    void client_bytes(MetricsWriter &writer) const {
+        string name = METRICS_PREFIX "client_bytes_total";
+        writer.describe(name, "counter", "Bytes of datagrams to clients: sent at once, queued "
+                                         "by pacing, sent from queue and dropped from it.");
+        for (size_t i = 0; i < workers.size(); ++i) {
+            const WorkerMetrics &metrics = workers[i]->get_metrics();
+            writer.sample(name, worker_label(i) + ",kind=\"sent\"", metrics.sent_bytes);
+            writer.sample(name, worker_label(i) + ",kind=\"queued\"", metrics.queued_bytes);
+            writer.sample(name, worker_label(i) + ",kind=\"paced\"", metrics.paced_bytes);
+            writer.sample(name, worker_label(i) + ",kind=\"dropped\"", metrics.dropped_bytes);
+        }
+    }
+
+    void clients(MetricsWriter &writer) const {
+        string name = METRICS_PREFIX "clients";
+        writer.describe(name, "gauge", "Connected clients by state.");
+        for (size_t i = 0; i < workers.size(); ++i) {
+            for (int state = 0; state < CLIENT_STATES; ++state) {
+                writer.sample(name, worker_label(i) + ",state=\"" + CLIENT_STATE_NAMES[state]
+                                    + "\"", workers[i]->get_metrics().clients[state]);
+            }
+        }
+    }
+
+    /* Answers client connected to the metrics socket and disconnects it. */
+    void serve(int client_fd) {
+        pollfd request{client_fd, POLLIN, 0};
+        char buffer[METRICS_REQUEST_SIZE];
+        ssize_t size = 0;
+        if (poll(&request, 1, METRICS_REQUEST_MILLIS) > 0) {
+            size = read(client_fd, buffer, sizeof(buffer));
+        }
+
+        string metrics = render();
+        if (size >= 4 && memcmp(buffer, "GET ", 4) == 0) {
+            metrics = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: " + to_string(metrics.size()) + "\r\n\r\n" + metrics;
+        }
+        for (size_t written = 0; written < metrics.size();) {
+            ssize_t ret = write(client_fd, metrics.data() + written, metrics.size() - written);
+            if (ret <= 0) {
+                break;
+            }
+            written += ret;
+        }
+        close(client_fd);
+    }
+
+    void listen_on(const string &path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            exit_error("Metrics socket path too long");
+        }
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0) {
+            exit_error("Socket error");
+        }
+        unlink(path.c_str()); // Left by previous run
+        if (bind(listen_fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+            exit_error("Bind error");
+        }
+        if (listen(listen_fd, SOMAXCONN) < 0) {
+            exit_error("Listen error");
+        }
+    }
+
+public:
+    /* Must be created before any other thread is started, so that SIGUSR1 is blocked in
+     * all of them and only read by the exporter. */
+    MetricsExporter(const vector<unique_ptr<Worker>> &_workers, const DatagramIo *_dispatcher_io,
+                    const string &path) : dispatcher_io(_dispatcher_io) {
+        for (auto &worker: _workers) {
+            workers.push_back(worker.get());
+        }
+
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR1);
+        if (pthread_sigmask(SIG_BLOCK, &signals, nullptr) != 0) {
+            exit_error("Sigmask error");
+        }
+        signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+        if (signal_fd < 0) {
+            exit_error("Signalfd error");
+        }
+        if (!path.empty()) {
+            listen_on(path);
+        }
+    }
+
+    MetricsExporter(const MetricsExporter &) = delete;
+
+    MetricsExporter &operator=(const MetricsExporter &) = delete;
+
+    /* Returns current metrics of all workers. */
+    string render() const {
+        MetricsWriter writer;
+        summaries(writer);
+        per_worker(writer, "rounds_total", "counter", "Rounds played.",
+                   [](const WorkerMetrics &metrics) { return metrics.game.rounds.load(); });
+        per_worker(writer, "skipped_rounds_total", "counter",
+                   "Rounds dropped because the server fell behind schedule.",
+                   [](const WorkerMetrics &metrics) {
+                       return metrics.game.skipped_rounds.load();
+                   });
+        per_worker(writer, "games_total", "counter", "Games started.",
+                   [](const WorkerMetrics &metrics) { return metrics.game.games.load(); });
+        per_worker(writer, "events_total", "counter", "Events generated.",
+                   [](const WorkerMetrics &metrics) { return metrics.game.events.load(); });
+        io_counter(writer, "datagrams_received_total", "Datagrams read from the socket.",
+                   &IoStats::datagrams_in);
+        io_counter(writer, "datagrams_sent_total", "Datagrams written to the socket.",
+                   &IoStats::datagrams_out);
+        io_counter(writer, "syscalls_total", "System calls reading or writing the socket.",
+                   &IoStats::syscalls);
+        io_counter(writer, "ticks_total", "Ticks of the I/O layer, each ended by sending "
+                                          "datagrams queued during it.", &IoStats::ticks);
+        io_counter(writer, "gso_sends_total", "Sends of several datagrams segmented by kernel.",
+                   &IoStats::gso_sends);
+        client_bytes(writer);
+        per_worker(writer, "retransmit_bytes_total", "counter",
+                   "Bytes of answers to clients' requests for missed events.",
+                   [](const WorkerMetrics &metrics) { return metrics.retransmit_bytes.load(); });
+        clients(writer);
+        per_worker(writer, "event_log_events", "gauge", "Events in logs of current games.",
+                   [](const WorkerMetrics &metrics) { return metrics.log_events.load(); });
+        per_worker(writer, "event_log_bytes", "gauge", "Bytes of logs of current games.",
+                   [](const WorkerMetrics &metrics) { return metrics.log_bytes.load(); });
+        return writer.text;
+    }
+
+    /* Exporter main loop. Waits for SIGUSR1 or a client of the metrics socket. */
+    [[noreturn]] void run() {
+        pollfd fds[2] = {{signal_fd, POLLIN, 0}, {listen_fd, POLLIN, 0}};
+        nfds_t count = listen_fd < 0 ? 1 : 2;
+
+        for (;;) {
+            if (poll(fds, count, -1) < 0 && errno != EINTR) {
+                exit_error("Poll error");
+            }
+            if (fds[0].revents & POLLIN) {
+                signalfd_siginfo info{};
+                (void) !read(signal_fd, &info, sizeof(info));
+                string metrics = render();
+                fwrite(metrics.data(), 1, metrics.size(), stderr);
+                fflush(stderr);
+            }
+            if (count > 1 && (fds[1].revents & POLLIN)) {
+                int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client_fd >= 0) {
+                    serve(client_fd);
+                }
+            }
+        }
+    }
+};
+
+#endif //SCREEN_WORMS_METRICS_EXPORTER_H
@@ -0,0 +1,161 @@
+#ifndef SCREEN_WORMS_PACER_H
+#define SCREEN_WORMS_PACER_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <algorithm>
+#include "../common/const.h"
+
+#define SEND_QUEUE_CAPACITY 256 // Datagrams waiting for a single client
+#define CLIENT_BURST_MILLIS 100 // Sending time at full rate client may get at once
+#define DEFAULT_CLIENT_RATE (1 << 20) // Bytes per second
+#define DEFAULT_EGRESS_BUDGET (256 * 1024) // Bytes per tick of a worker
+#define EGRESS_RETRY_MICROS 1000 // Pause after a tick which used up the egress budget
+
+using namespace std;
+
+using SteadyTime = chrono::steady_clock::time_point;
+
+/* Token bucket holding up to burst bytes, refilled with rate bytes per second. */
+class TokenBucket {
+private:
+    double tokens = 0;
+    SteadyTime last_refill;
+
+    void refill(SteadyTime now) {
+        chrono::duration<double> elapsed = now - last_refill;
+        tokens = min(burst, tokens + rate * elapsed.count());
+        last_refill = now;
+    }
+
+public:
+    double rate = DEFAULT_CLIENT_RATE;
+    double burst = DATAGRAM_SIZE;
+
+    /* Starts with a full bucket holding CLIENT_BURST_MILLIS worth of bytes, but at least
+     * a whole datagram. */
+    void start(double _rate) {
+        rate = _rate;
+        burst = max((double) DATAGRAM_SIZE, rate * CLIENT_BURST_MILLIS / 1000);
+        tokens = burst;
+        last_refill = chrono::steady_clock::now();
+    }
+
+    /* Takes tokens for given number of bytes. Returns false and takes nothing if there are
+     * not enough of them. */
+    bool take(size_t bytes, SteadyTime now) {
+        refill(now);
+        if (tokens < bytes) {
+            return false;
+        }
+        tokens -= bytes;
+        return true;
+    }
+
+    /* Returns time left until tokens for given number of bytes are available. */
+    chrono::nanoseconds time_until(size_t bytes, SteadyTime now) {
+        refill(now);
+        if (tokens >= bytes) {
+            return chrono::nanoseconds(0);
+        }
+        return chrono::duration_cast<chrono::nanoseconds>(
+                chrono::duration<double>((bytes - tokens) / rate));
+    }
+};
+
+/* Bytes passing through send queue of a single client. Every queued byte is eventually
+ * paced (sent later) or dropped, unless it is still waiting. */
+class SendCounters {
+public:
+    uint64_t sent_bytes = 0; // Sent at once, without queueing
+    uint64_t queued_bytes = 0;
+    uint64_t paced_bytes = 0;
+    uint64_t dropped_bytes = 0;
+};
+
+/* Copy of a datagram which could not be sent at once. */
+class QueuedDatagram {
+public:
+    bool retransmit; // Answer to client's request, client asks for it again if it is lost
+    bool whole; // Part of NEW_GAME and snapshot answer, client never asks for it again
+    uint32_t length;
+    char data[DATAGRAM_SIZE];
+};
+
+/* Datagrams of a single client which wait for tokens of its bucket or for egress budget.
+ * When the queue is full the oldest retransmission is dropped, or the oldest datagram if
+ * there is none, since retransmitted events are requested again by the client's next
+ * message while new events are broadcast only once. Parts of a snapshot answer are dropped
+ * only if nothing else is queued. The queue then holds more than one such answer and the
+ * newest one is kept whole, as it is shorter than the queue. */
+class SendQueue {
+private:
+    deque<QueuedDatagram> datagrams;
+    size_t whole_count = 0; // Queued datagrams which are parts of snapshot answers
+
+    /* Drops one datagram to make room for a new one. Returns its length. */
+    size_t drop() {
+        auto victim = find_if(datagrams.begin(), datagrams.end(),
+                              [](const QueuedDatagram &datagram) {
+                                  return datagram.retransmit && !datagram.whole;
+                              });
+        if (victim == datagrams.end()) {
+            victim = find_if(datagrams.begin(), datagrams.end(),
+                             [](const QueuedDatagram &datagram) { return !datagram.whole; });
+        }
+        if (victim == datagrams.end()) {
+            victim = datagrams.begin();
+        }
+        size_t length = victim->length;
+        counters.dropped_bytes += length;
+        whole_count -= victim->whole;
+        datagrams.erase(victim);
+        return length;
+    }
+
+public:
+    TokenBucket bucket;
+    SendCounters counters;
+
+    bool empty() const {
+        return datagrams.empty();
+    }
+
+    /* Returns true if some snapshot answer still waits in the queue. */
+    bool holds_whole() const {
+        return whole_count > 0;
+    }
+
+    /* Stores copy of the datagram, dropping another one if the queue is full. Returns number
+     * of dropped bytes. */
+    size_t push(const char *data, size_t length, bool retransmit, bool whole) {
+        size_t dropped = 0;
+        if (datagrams.size() >= SEND_QUEUE_CAPACITY) {
+            dropped = drop();
+        }
+        datagrams.emplace_back();
+        QueuedDatagram &datagram = datagrams.back();
+        datagram.retransmit = retransmit;
+        datagram.whole = whole;
+        whole_count += whole;
+        datagram.length = length;
+        memcpy(datagram.data, data, length);
+        counters.queued_bytes += length;
+        return dropped;
+    }
+
+    const QueuedDatagram &front() const {
+        return datagrams.front();
+    }
+
+    /* Removes the oldest datagram after it was sent. */
+    void pop() {
+        counters.paced_bytes += datagrams.front().length;
+        whole_count -= datagrams.front().whole;
+        datagrams.pop_front();
+    }
+};
+
+#endif //SCREEN_WORMS_PACER_H
@@ -0,0 +1,277 @@
+#ifndef SCREEN_WORMS_ROOM_H
+#define SCREEN_WORMS_ROOM_H
+
+#include <utility>
+#include <cstring>
+#include <netinet/in.h>
+#include "../utils/util_func.h"
+#include "game_manager.cpp"
+#include "datagram_io.h"
+#include "session_table.h"
+#include "pacer.h"
+#include "worker_metrics.h"
+
+#define TIMEOUT_MILLIS 2000
+
+static_assert(SNAPSHOT_MAX_PARTS + 1 <= SEND_QUEUE_CAPACITY,
+              "Snapshot answer has to fit into send queue of a client");
+
+using namespace std;
+
+/* Checks if message size and player name in message from client are correct. */
+inline bool msg_from_client_valid(const char *buffer, size_t size) {
+    if (size < MIN_CLIENT_MSG_LEN || MAX_CLIENT_MSG_LEN < size) {
+        return false;
+    }
+    ClientToServerMsg msg(buffer, size);
+    if (!player_name_valid(msg.player_name)) {
+        return false;
+    }
+    return true;
+}
+
+/* Single independent game together with clients taking part in it. Room is owned by
+ * exactly one thread, which passes it datagrams of its clients and I/O layer answers are
+ * written to, so no state of the room is ever shared. */
+class Room {
+private:
+    SessionTable clients = SessionTable(chrono::milliseconds(TIMEOUT_MILLIS));
+    bool egress_exhausted = false; // Some datagram waits for egress budget of next tick
+    WorkerMetrics *metrics = nullptr;
+    size_t drain_start = 0; // Client whose queue is drained first in next tick
+
+    static uint64_t get_session_id(const char *buffer) {
+        uint64_t id;
+        memcpy(&id, buffer, 8);
+        return id;
+    }
+
+    /* Returns time left until earliest client timeout or maximal duration if there are no
+     * clients. */
+    chrono::nanoseconds time_to_next_timeout() {
+        SteadyTime deadline = clients.next_deadline();
+        if (deadline == SteadyTime::max()) {
+            return chrono::nanoseconds::max();
+        }
+        return max(deadline - chrono::steady_clock::now(), chrono::nanoseconds(0));
+    }
+
+    /* Function checks if address details and its session_id and calls appropriate
+     * game manager function. */
+    ServerMsg manage_message(const sockaddr_in6 &client_addr, const char *buffer,
+                             size_t size) {
+        ClientToServerMsg msg(buffer, size);
+        Session *session = clients.find(client_addr);
+        uint64_t session_id = get_session_id(buffer);
+
+        if (session == nullptr) { // Client connected first time.
+            if (clients.size() >= PLAYERS_LIMIT) {
+                return ServerMsg();
+            }
+            Session &session = clients.insert(client_addr, session_id, msg.player_name);
+            session.outbox.bucket.start(client_rate);
+            return game_manager.new_participant(msg, msg.player_name);
+        }
+        else if (session->session_id == session_id) { // New message from known client.
+            if (msg.player_name != session->player_name) { // Known client but different name - ignore.
+                return ServerMsg();
+            }
+            session->touch();
+            return game_manager.new_message(msg, session->player_name);
+        }
+        else if (session->session_id > session_id) { // New, greater session_id from known client.
+            session->player_name = msg.player_name;
+            session->touch();
+            game_manager.player_disconnected(session->player_name);
+            return game_manager.new_participant(msg, msg.player_name);
+        }
+        else { // Smaller session_id from known client - ignore.
+            return ServerMsg();
+        }
+    }
+
+    /* Disconnects participants which timed out and reports them to game manager. */
+    void check_timeouts() {
+        clients.expire([this](Session &session) {
+            game_manager.player_disconnected(session.player_name);
+        });
+    }
+
+    /* Calls send or send to all depending on flag to_all in message object. */
+    void manage_answer(ServerMsg &answer, const sockaddr_in6 &client_addr, DatagramIo &io) {
+        if (!answer.empty()) {
+            if (answer.to_all) {
+                send_answer_to_all(answer, io);
+            }
+            else {
+                send_answer(answer, client_addr, io);
+            }
+        }
+    }
+
+    /* Queues all datagrams for every client. Datagrams are built once for all of them. */
+    void send_answer_to_all(ServerMsg &answer, DatagramIo &io) {
+        pair<size_t, size_t> datagrams = add_payloads(answer, io);
+        for (auto &session: clients) {
+            send_datagrams(datagrams, session, false, 0, io);
+        }
+    }
+
+    /* Queues all datagrams for given client. Snapshot answer is not repeated while the
+     * previous one still waits in the client's queue, client gets that one anyway. */
+    void send_answer(ServerMsg &answer, const sockaddr_in6 &client_addr, DatagramIo &io) {
+        Session *session = clients.find(client_addr);
+        if (session != nullptr
+            && (answer.whole_datagrams == 0 || !session->outbox.holds_whole())) {
+            send_datagrams(add_payloads(answer, io), *session, true, answer.whole_datagrams,
+                           io);
+        }
+    }
+
+    /* Writes datagrams of the answer, at most its max_datagrams, into I/O layer buffers.
+     * Returns range of their handles, first inclusive and second exclusive. */
+    static pair<size_t, size_t> add_payloads(ServerMsg &answer, DatagramIo &io) {
+        size_t next_event = answer.first_event, first = io.payload_count();
+        while (next_event < answer.last_event
+               && io.payload_count() - first < answer.max_datagrams) {
+            io.commit_payload(answer.write_datagram(next_event, io.new_payload()));
+        }
+        return {first, io.payload_count()};
+    }
+
+    /* Queues datagrams to be sent to given client when current tick ends. Datagrams which
+     * the client's pacer or egress budget do not let through, or which would overtake
+     * datagrams already waiting, are copied into the client's send queue. The first whole
+     * datagrams are queued so that they are not dropped. */
+    void send_datagrams(pair<size_t, size_t> datagrams, Session &session, bool retransmit,
+                        size_t whole, DatagramIo &io) {
+        SteadyTime now = chrono::steady_clock::now();
+        for (size_t datagram = datagrams.first; datagram < datagrams.second; ++datagram) {
+            size_t length = io.payload_length(datagram);
+            bool within_budget = io.within_budget(length);
+            egress_exhausted |= !within_budget;
+            if (retransmit) {
+                metrics->retransmit_bytes += length;
+            }
+            if (session.outbox.empty() && within_budget
+                && session.outbox.bucket.take(length, now)) {
+                io.queue(datagram, session.addr);
+                session.outbox.counters.sent_bytes += length;
+                metrics->sent_bytes += length;
+            }
+            else {
+                metrics->dropped_bytes += session.outbox.push(
+                        io.payload(datagram), length, retransmit,
+                        datagram - datagrams.first < whole);
+                metrics->queued_bytes += length;
+            }
+        }
+    }
+
+    /* Sends queued datagrams as far as tokens of their clients and egress budget allow.
+     * Every tick another client is served first, so that clients share the budget. */
+    void drain_queues(DatagramIo &io) {
+        egress_exhausted = false;
+        if (clients.size() == 0) {
+            return;
+        }
+
+        SteadyTime now = chrono::steady_clock::now();
+        size_t count = clients.size();
+        drain_start %= count;
+        for (size_t i = 0; i < count; ++i) {
+            Session &session = *(clients.begin() + (drain_start + i) % count);
+            SendQueue &outbox = session.outbox;
+            while (!outbox.empty()) {
+                size_t length = outbox.front().length;
+                if (!io.within_budget(length)) {
+                    egress_exhausted = true;
+                    break;
+                }
+                if (!outbox.bucket.take(length, now)) {
+                    break;
+                }
+                memcpy(io.new_payload(), outbox.front().data, length);
+                io.queue(io.commit_payload(length), session.addr);
+                outbox.pop();
+                metrics->paced_bytes += length;
+            }
+        }
+        ++drain_start;
+    }
+
+    /* Returns time left until some queued datagram may be sent or maximal duration if
+     * nothing waits. */
+    chrono::nanoseconds time_to_next_send() {
+        if (egress_exhausted) {
+            return chrono::microseconds(EGRESS_RETRY_MICROS);
+        }
+        SteadyTime now = chrono::steady_clock::now();
+        auto left = chrono::nanoseconds::max();
+        for (auto &session: clients) {
+            if (!session.outbox.empty()) {
+                left = min(left, session.outbox.bucket.time_until(
+                        session.outbox.front().length, now));
+            }
+        }
+        return left;
+    }
+
+public:
+    GameManager game_manager;
+    uint32_t client_rate = DEFAULT_CLIENT_RATE; // Bytes per second sent to a single client
+
+    Room() = default;
+
+    explicit Room(const GameManager &_game_manager) : game_manager(_game_manager) {}
+
+    /* Makes room and its game manager record into given metrics. Must be called before
+     * the room handles anything. */
+    void attach_metrics(WorkerMetrics &_metrics) {
+        metrics = &_metrics;
+        game_manager.metrics = &_metrics.game;
+    }
+
+    /* Adds clients of the room to counts of their states and events of its current game to
+     * sizes of logs. */
+    void count_clients(uint64_t *states, uint64_t &log_events, uint64_t &log_bytes) const {
+        uint64_t players[CLIENT_STATES] = {};
+        game_manager.count_players(players);
+        uint64_t players_count = 0;
+        for (int state = 0; state < CLIENT_STATES; ++state) {
+            states[state] += players[state];
+            players_count += players[state];
+        }
+        states[CLIENT_OBSERVER] += clients.size() - min((uint64_t) clients.size(), players_count);
+        log_events += game_manager.game_state.events.size();
+        log_bytes += game_manager.game_state.events.byte_size();
+    }
+
+    /* Handles datagram received from client and queues answer to it. Datagram must have
+     * been checked with msg_from_client_valid before it was routed to the room. Returns
+     * true if the room has the client afterwards, false if it turned the client away. */
+    bool handle_datagram(const sockaddr_in6 &client_addr, const char *buffer, size_t size,
+                         DatagramIo &io) {
+        ServerMsg answer = manage_message(client_addr, buffer, size);
+        manage_answer(answer, client_addr, io);
+        return clients.find(client_addr) != nullptr;
+    }
+
+    /* Disconnects timed out clients, sends what pacing let through, performs next round if
+     * it is due and queues events generated by it for all clients. */
+    void run_round(DatagramIo &io) {
+        check_timeouts();
+        drain_queues(io);
+        ServerMsg answer = game_manager.cyclic_activities();
+        manage_answer(answer, sockaddr_in6(), io);
+    }
+
+    /* Returns time left until next round, client timeout or paced send, whichever comes
+     * first. */
+    chrono::nanoseconds time_to_next_event() {
+        return min({game_manager.time_to_next_round(), time_to_next_timeout(),
+                    time_to_next_send()});
+    }
+};
+
+#endif //SCREEN_WORMS_ROOM_H
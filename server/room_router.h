@@ -0,0 +1,81 @@
+#ifndef SCREEN_WORMS_ROOM_ROUTER_H
+#define SCREEN_WORMS_ROOM_ROUTER_H
+
+#include <vector>
+#include <algorithm>
+#include "../common/const.h"
+#include "session_table.h"
+
+using namespace std;
+
+/* Decides which room datagrams of a client belong to. Client keeps its room as long as it
+ * keeps sending, new clients fill rooms one after another, so that rooms get enough
+ * players to start a game. Whether a client is admitted is decided by the room itself,
+ * router only spreads the load. New client is counted in the room it is routed to in
+ * advance, unless all rooms are full, and the count is corrected once the room reports
+ * whether it admitted the client. So clients turned away by their room do not take the
+ * places of clients routed later. */
+class RoomRouter {
+private:
+    RouteTable routes;
+    vector<uint32_t> clients_in_room;
+
+public:
+    RoomRouter(uint32_t rooms, chrono::milliseconds timeout) :
+            routes(timeout),
+            clients_in_room(rooms, 0) {}
+
+    /* Returns route of given client, assigning a room if client is new. Route is valid
+     * until the next call. */
+    const Route &route(const sockaddr_in6 &client_addr) {
+        Route *route = routes.find(client_addr);
+        if (route != nullptr) {
+            route->touch();
+            return *route;
+        }
+
+        auto room = find_if(clients_in_room.begin(), clients_in_room.end(),
+                            [](uint32_t clients) { return clients < PLAYERS_LIMIT; });
+        bool counted = room != clients_in_room.end();
+        if (!counted) { // All rooms full, room decides about client.
+            room = min_element(clients_in_room.begin(), clients_in_room.end());
+        }
+        Route &new_route = routes.insert(client_addr, room - clients_in_room.begin());
+        if (counted) {
+            ++*room;
+            new_route.counted = true;
+        }
+        return new_route;
+    }
+
+    /* Records whether given room has the client after handling its datagram. Reports about
+     * a route which expired or changed its room since are ignored. */
+    void report(const sockaddr_in6 &client_addr, uint32_t room, bool admitted) {
+        Route *route = routes.find(client_addr);
+        if (route == nullptr || route->room != room || route->counted == admitted) {
+            return;
+        }
+        route->counted = admitted;
+        if (admitted) {
+            ++clients_in_room[room];
+        }
+        else {
+            --clients_in_room[room];
+        }
+    }
+
+    /* Forgets clients which have not sent anything for the timeout. */
+    void expire() {
+        routes.expire([this](Route &route) {
+            if (route.counted) {
+                --clients_in_room[route.room];
+            }
+        });
+    }
+
+    SteadyTime next_deadline() {
+        return routes.next_deadline();
+    }
+};
+
+#endif //SCREEN_WORMS_ROOM_ROUTER_H
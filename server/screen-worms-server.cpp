@@ -1,64 +1,127 @@
-#include <utility>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <pthread.h>
 #include <unistd.h>
 #include <cstring>
-#include <map>
 #include <uv.h>
-#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <linux/filter.h>
 #include "../utils/util_func.h"
-#include "game_manager.cpp"
+#include "datagram_io.h"
+#include "uring_io.h"
+#include "room.h"
+#include "room_router.h"
+#include "worker.h"
+#include "metrics_exporter.h"
 
 #define MIN_PORT 1
 #define MAX_PORT 65535
-#define TIMEOUT_MILLIS 2000
+#define MIN_WORKERS 1
+#define MAX_WORKERS 256
+#define MIN_ROOMS_PER_WORKER 1
+#define MAX_ROOMS_PER_WORKER 1024
+#define MIN_CLIENT_RATE DATAGRAM_SIZE
+#define MAX_CLIENT_RATE (1 << 30)
+#define MIN_EGRESS_BUDGET DATAGRAM_SIZE
+#define MAX_EGRESS_BUDGET (1 << 30)
+#define MAX_METRICS_PATH (sizeof(sockaddr_un::sun_path) - 1)
 
 using namespace std;
-using ClientSock = pair<in_port_t, struct in6_addr>;
-using ClientId = pair<uint64_t, string>;
-
-struct cmp_ids {
-    bool operator()(const ClientSock left, const ClientSock &right) const {
-        char l_str[INET6_ADDRSTRLEN], r_str[INET6_ADDRSTRLEN];
-        inet_ntop(AF_INET6, &left.second, l_str, sizeof(l_str));
-        inet_ntop(AF_INET6, &left.second, r_str, sizeof(r_str));
-        return left.first < right.first
-               || (left.first == right.first && string(l_str) < string(r_str));
-    }
-};
 
+/* Server hosts rooms_per_worker independent games on each of workers threads. With a single
+ * worker it runs in the main thread and reads the socket itself. Otherwise main thread is a
+ * dispatcher: it reads the socket, routes every datagram to a room and passes it to the
+ * worker owning that room through a lock-free queue.
+ *
+ * With reuse_port every worker opens its own SO_REUSEPORT socket on the port instead and
+ * reads it itself, so there is no dispatcher. Kernel picks the socket by hash of the
+ * client's address and port, which is the same for all datagrams of a client, so client
+ * stays with its worker.
+ *
+ * Metrics of all workers are written to standard error on SIGUSR1 and served on a Unix
+ * domain socket if its path is given. */
 class Server {
 public:
-    GameManager game_manager;
-    pollfd pol{};
+    GameManager settings; // Game parameters shared by all rooms
+    int64_t seed = time(nullptr);
+    uint32_t workers_count = 1;
+    uint32_t rooms_per_worker = 1;
+    bool reuse_port = false;
+    uint32_t client_rate = DEFAULT_CLIENT_RATE;
+    uint32_t egress_budget = DEFAULT_EGRESS_BUDGET;
+    IoBackend io_backend = IO_MMSG;
+    int sock = -1;
+    unique_ptr<DatagramIo> io; // Dispatcher only
+    int epoll_fd = -1;
     int port_num = 2021;
-    map<ClientSock, ClientId, cmp_ids> clients;
-    map<ClientSock, Timer, cmp_ids> timers;
+    vector<unique_ptr<Worker>> workers;
+    string metrics_path; // Metrics socket is not opened if empty
+    unique_ptr<MetricsExporter> exporter;
 
     /* Returns true in case of success or false otherwise. */
     bool parse_args(int argc, char **argv) {
         int opt;
 
-        while ((opt = getopt(argc, argv, "p:s:t:v:w:h:")) != -1) {
+        while ((opt = getopt(argc, argv, "p:s:t:v:w:h:c:r:ui:k:m:j:b:a:e:x:")) != -1) {
             try {
                 switch (opt) {
                     case 'p':
                         this->set_port(string_to_int(optarg));
                         break;
                     case 's':
-                        game_manager.set_rng(string_to_int(optarg));
+                        this->set_seed(string_to_int(optarg));
                         break;
                     case 't':
-                        game_manager.set_turning_speed(string_to_int(optarg));
+                        settings.set_turning_speed(string_to_int(optarg));
                         break;
                     case 'v':
-                        game_manager.set_rounds_per_sec(string_to_int(optarg));
+                        settings.set_rounds_per_sec(string_to_int(optarg));
                         break;
                     case 'w':
-                        game_manager.set_width(string_to_int(optarg));
+                        settings.set_width(string_to_int(optarg));
                         break;
                     case 'h':
-                        game_manager.set_height(string_to_int(optarg));
+                        settings.set_height(string_to_int(optarg));
+                        break;
+                    case 'c':
+                        this->set_workers_count(string_to_int(optarg));
+                        break;
+                    case 'r':
+                        this->set_rooms_per_worker(string_to_int(optarg));
+                        break;
+                    case 'u':
+                        reuse_port = true;
+                        break;
+                    case 'i':
+                        if (!this->set_io_backend(optarg)) {
+                            return false;
+                        }
+                        break;
+                    case 'k':
+                        if (!this->set_catch_up_policy(optarg)) {
+                            return false;
+                        }
+                        break;
+                    case 'm':
+                        settings.set_max_catch_up(string_to_int(optarg));
+                        break;
+                    case 'j':
+                        settings.set_snapshot_min_events(string_to_int(optarg));
+                        break;
+                    case 'b':
+                        settings.set_retransmit_datagrams(string_to_int(optarg));
+                        break;
+                    case 'a':
+                        this->set_client_rate(string_to_int(optarg));
+                        break;
+                    case 'e':
+                        this->set_egress_budget(string_to_int(optarg));
+                        break;
+                    case 'x':
+                        this->set_metrics_path(optarg);
                         break;
                     default: // Unknown option or '?' - input incorrect
                         return false;
@@ -77,184 +140,241 @@ public:
         return (optind >= argc); // We do not accept non option arguments
     }
 
-    /* Prepares server before starting communication. */
+    /* Prepares server before starting communication. Creates sockets, workers with their
+     * rooms and metrics exporter. Room number i is seeded with seed + i, so that games in
+     * different rooms differ and the first room behaves as the only room did. */
     void prepare() {
-        sockaddr_in6 local_addr{};
+        sock = open_socket();
 
-        pol.events = POLLIN;
-        pol.fd = socket(AF_INET6, SOCK_DGRAM, 0);
-        if (pol.fd < 0) {
-            exit_error("Socket error");
+        for (uint32_t worker = 0; worker < workers_count; ++worker) {
+            vector<Room> rooms;
+            for (uint32_t i = 0; i < rooms_per_worker; ++i) {
+                rooms.emplace_back(settings);
+                rooms.back().client_rate = client_rate;
+                rooms.back().game_manager.set_rng(
+                        (seed + worker * rooms_per_worker + i) % ((int64_t) MAX_SEED + 1));
+            }
+            int worker_sock = (reuse_port && worker > 0) ? open_socket() : sock;
+            workers.push_back(make_unique<Worker>(std::move(rooms), worker * rooms_per_worker,
+                                                  worker_sock, runs_direct(), io_backend,
+                                                  egress_budget));
         }
-
-        memset(&local_addr, 0, sizeof(local_addr));
-        local_addr.sin6_family = AF_INET6;
-        local_addr.sin6_port = htons(port_num);
-        local_addr.sin6_addr = in6addr_any;
-
-        if (bind(pol.fd, (sockaddr *) &local_addr, sizeof(local_addr)) < 0) {
-            exit_error("Bind error");
+        if (reuse_port) {
+            attach_steering();
         }
+        if (!runs_direct()) {
+            prepare_dispatcher();
+        }
+        exporter = make_unique<MetricsExporter>(workers, io.get(), metrics_path);
     }
 
-    /* Server main loop consisting of checking incoming datagrams, running cyclical game
-     * activities and sending answer datagrams. */
+    /* Starts workers and metrics exporter. Every worker except the first gets its own
+     * thread, pinned to a core if there are enough of them. Workers reading their sockets
+     * directly leave the first worker to the calling thread, otherwise it gets a thread as
+     * well and calling thread becomes the dispatcher. */
     [[noreturn]] void run() {
-        sockaddr_in6 client_addr{};
-        char buffer[DATAGRAM_SIZE];
-        int ret, rcv_len;
-        ServerMsg answer;
-
-        for (;;) {
-            answer = ServerMsg();
-            pol.revents = 0;
+        thread(&MetricsExporter::run, exporter.get()).detach();
 
-            ret = poll(&pol, 1, 0);
-            if (ret > 0 && (pol.revents & (POLLIN | POLLERR))) {
-                rcv_len = receive_message(buffer, client_addr);
-                if (rcv_len > 0) {
-                    answer = manage_message(client_addr.sin6_port,
-                                            client_addr.sin6_addr, buffer, rcv_len);
-                    manage_answer(answer, buffer, client_addr);
-                }
-            }
+        unsigned cores = max(thread::hardware_concurrency(), 1u);
+        for (size_t i = runs_direct() ? 1 : 0; i < workers.size(); ++i) {
+            thread worker_thread(&Worker::run, workers[i].get());
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % cores, &cpus);
+            pthread_setaffinity_np(worker_thread.native_handle(), sizeof(cpus), &cpus);
+            worker_thread.detach();
+        }
 
-            check_timeouts();
-            answer = game_manager.cyclic_activities();
-            manage_answer(answer, buffer, client_addr);
+        if (runs_direct()) {
+            workers[0]->run();
         }
+        dispatch();
     }
 
 private:
+    /* Opens I/O of the dispatcher and epoll watching its socket. */
+    void prepare_dispatcher() {
+        io = open_datagram_io(io_backend, sock, true);
+        epoll_fd = epoll_create1(0);
+        if (epoll_fd < 0) {
+            exit_error("Epoll error");
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = io->wait_fd();
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, io->wait_fd(), &event) < 0) {
+            exit_error("Epoll ctl error");
+        }
+    }
+
     void set_port(int64_t port) {
         check_limits(port, MIN_PORT, MAX_PORT, "Port");
         this->port_num = port;
     }
 
-    static uint64_t get_session_id(char *buffer) {
-        uint64_t id;
-        memcpy(&id, buffer, 8);
-        return id;
+    bool runs_direct() const {
+        return workers_count == 1 || reuse_port;
     }
 
-    /* Checks if message size and player name in message from client are correct. */
-    static bool msg_from_client_valid(char *buffer, size_t size) {
-        if (size < MIN_CLIENT_MSG_LEN || MAX_CLIENT_MSG_LEN < size) {
-            return false;
+    /* Creates socket bound to the server port, with SO_REUSEPORT set if every worker should
+     * have its own socket. */
+    int open_socket() {
+        sockaddr_in6 local_addr{};
+        int one = 1;
+
+        int new_sock = socket(AF_INET6, SOCK_DGRAM, 0);
+        if (new_sock < 0) {
+            exit_error("Socket error");
         }
-        ClientToServerMsg msg(buffer, size);
-        if (!player_name_valid(msg.player_name)) {
-            return false;
+        if (reuse_port && setsockopt(new_sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+            exit_error("Setsockopt error");
         }
-        return true;
-    }
 
-    /* Function checks if address details and its session_id and calls appropriate
-     * game manager function. */
-    ServerMsg manage_message(in_port_t client_port, struct in6_addr ip6_addr, char *buffer,
-                             size_t size) {
-        if (!msg_from_client_valid(buffer, size)) {
-            return ServerMsg();
-        }
+        memset(&local_addr, 0, sizeof(local_addr));
+        local_addr.sin6_family = AF_INET6;
+        local_addr.sin6_port = htons(port_num);
+        local_addr.sin6_addr = in6addr_any;
 
-        ClientToServerMsg msg(buffer, size);
-        auto client_sock = ClientSock(client_port, ip6_addr);
-        auto iter = clients.find(client_sock);
-        uint64_t session_id = get_session_id(buffer);
+        if (bind(new_sock, (sockaddr *) &local_addr, sizeof(local_addr)) < 0) {
+            exit_error("Bind error");
+        }
+        return new_sock;
+    }
 
-        if (iter == clients.end()) { // Client connected first time.
-            if (clients.size() >= PLAYERS_LIMIT) {
-                return ServerMsg();
-            }
-            clients[client_sock] = ClientId(session_id, msg.player_name);
-            timers[client_sock] = Timer();
-            timers[client_sock].start();
-            return game_manager.new_participant(msg, msg.player_name);
+    /* Makes kernel choose socket number hash % workers_count for every datagram, where
+     * hash mixes the last word of the source address with the source port, both read from
+     * the packet. Sockets are numbered in order they were bound, so it is also number of
+     * the worker. Kernel's flow hash is not used, it is zero when the device computes none,
+     * e.g. on loopback. IPv6 packets are assumed to carry no extension headers. If the
+     * program cannot be attached kernel's default choice is kept, which is reported. */
+    void attach_steering() {
+        auto net = (uint32_t) SKF_NET_OFF;
+        sock_filter code[] = {
+                {BPF_LD | BPF_B | BPF_ABS, 0, 0, net}, // IP version
+                {BPF_ALU | BPF_RSH | BPF_K, 0, 0, 4},
+                {BPF_JMP | BPF_JEQ | BPF_K, 0, 4, 6},
+                {BPF_LD | BPF_W | BPF_ABS, 0, 0, net + 20}, // IPv6 source address
+                {BPF_ST, 0, 0, 0},
+                {BPF_LD | BPF_H | BPF_ABS, 0, 0, net + 40}, // UDP source port
+                {BPF_JMP | BPF_JA, 0, 0, 4},
+                {BPF_LD | BPF_W | BPF_ABS, 0, 0, net + 12}, // IPv4 source address
+                {BPF_ST, 0, 0, 0},
+                {BPF_LDX | BPF_B | BPF_MSH, 0, 0, net}, // IPv4 header length
+                {BPF_LD | BPF_H | BPF_IND, 0, 0, net}, // UDP source port
+                {BPF_LDX | BPF_MEM, 0, 0, 0},
+                {BPF_ALU | BPF_XOR | BPF_X, 0, 0, 0},
+                {BPF_ALU | BPF_MUL | BPF_K, 0, 0, 0x9e3779b1},
+                {BPF_ALU | BPF_RSH | BPF_K, 0, 0, 16},
+                {BPF_ALU | BPF_MOD | BPF_K, 0, 0, workers_count},
+                {BPF_RET | BPF_A, 0, 0, 0},
+        };
+        sock_fprog program{};
+        program.len = sizeof(code) / sizeof(code[0]);
+        program.filter = code;
+        if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program,
+                       sizeof(program)) < 0) {
+            cerr << "Steering program not attached, kernel spreads clients over workers: "
+                 << strerror(errno) << endl;
         }
-        else if (iter->second.first == session_id) { // New message from known client.
-            if (msg.player_name != iter->second.second) { // Known client but different name - ignore.
-                return ServerMsg();
-            }
-            timers[client_sock].start();
-            return game_manager.new_message(msg, iter->second.second);
+    }
+
+    /* Returns false if there is no backend of given name. */
+    bool set_io_backend(const string &name) {
+        if (name == "mmsg") {
+            io_backend = IO_MMSG;
         }
-        else if (iter->second.first > session_id) { // New, greater session_id from known client.
-            clients[client_sock] = ClientId(iter->second.first, msg.player_name);
-            timers[client_sock].start();
-            game_manager.player_disconnected(iter->second.second);
-            return game_manager.new_participant(msg, msg.player_name);
+        else if (name == "uring") {
+            io_backend = IO_URING;
         }
-        else { // Smaller session_id from known client - ignore.
-            return ServerMsg();
+        else {
+            return false;
         }
+        return true;
     }
 
-    /* Checks timer for every connected participant. If timeout appeared then participant is
-     * disconnected and reported to game manager. */
-    void check_timeouts() {
-        auto iter = timers.begin();
-        while (iter != timers.end()) {
-            auto &client_sock = iter->first;
-            auto &client_timer = iter->second;
-            if (client_timer.timeout(TIMEOUT_MILLIS)) {
-                game_manager.player_disconnected(clients[client_sock].second);
-                clients.erase(client_sock);
-                auto to_delete = iter;
-                ++iter;
-                timers.erase(to_delete);
-            }
-            else {
-                ++iter;
-            }
+    /* Returns false if there is no catch up policy of given name. */
+    bool set_catch_up_policy(const string &name) {
+        if (name == "burst") {
+            settings.scheduler.policy = CATCH_UP_BURST;
         }
+        else if (name == "skip") {
+            settings.scheduler.policy = CATCH_UP_SKIP;
+        }
+        else {
+            return false;
+        }
+        return true;
     }
 
-    size_t receive_message(char *buffer, sockaddr_in6 &client_addr) {
-        socklen_t addr_size = sizeof(client_addr);
+    void set_seed(int64_t _seed) {
+        check_limits(_seed, MIN_SEED, MAX_SEED, "Seed");
+        this->seed = _seed;
+    }
 
-        memset(buffer, 0, DATAGRAM_SIZE);
-        memset(&client_addr, 0, sizeof(client_addr));
-        return recvfrom(pol.fd, buffer, DATAGRAM_SIZE, 0, (sockaddr *) &client_addr,
-                        &addr_size);
+    void set_workers_count(int64_t count) {
+        check_limits(count, MIN_WORKERS, MAX_WORKERS, "Workers");
+        this->workers_count = count;
     }
 
-    /* Calls send or send to all depending on flag to_all in message object. */
-    void manage_answer(ServerMsg &answer, char *buffer, sockaddr_in6 &client_addr) {
-        if (!answer.empty()) {
-            if (answer.to_all) {
-                send_answer_to_all(answer, buffer);
-            }
-            else {
-                send_answer(answer, buffer, client_addr);
-            }
-        }
+    void set_rooms_per_worker(int64_t count) {
+        check_limits(count, MIN_ROOMS_PER_WORKER, MAX_ROOMS_PER_WORKER, "Rooms per worker");
+        this->rooms_per_worker = count;
     }
 
-    void send_answer_to_all(ServerMsg &answer, char *buffer) {
-        for (auto &iter: clients) {
-            sockaddr_in6 client_addr{};
-            client_addr.sin6_family = AF_INET6;
-            client_addr.sin6_port = iter.first.first;
-            client_addr.sin6_addr = iter.first.second;
-            send_answer(answer, buffer, client_addr);
-        }
+    void set_client_rate(int64_t rate) {
+        check_limits(rate, MIN_CLIENT_RATE, MAX_CLIENT_RATE, "Client rate");
+        this->client_rate = rate;
     }
 
-    /* Sends all datagrams to given client. */
-    void send_answer(ServerMsg &answer, char *buffer, sockaddr_in6 &client_addr) {
-        vector<string> names;
-        for (const auto &iter: clients) {
-            names.push_back(iter.second.second);
-        }
+    void set_egress_budget(int64_t budget) {
+        check_limits(budget, MIN_EGRESS_BUDGET, MAX_EGRESS_BUDGET, "Egress budget");
+        this->egress_budget = budget;
+    }
+
+    void set_metrics_path(const string &path) {
+        check_limits(path.size(), 1, MAX_METRICS_PATH, "Metrics socket path length");
+        this->metrics_path = path;
+    }
 
-        for (auto &datagram: answer.get_datagrams()) {
-            memset(buffer, 0, DATAGRAM_SIZE);
-            memcpy(buffer, datagram.c_str(), datagram.length());
+    /* Dispatcher main loop. Reads datagrams in batches, drops invalid ones and passes the
+     * rest to workers owning rooms of their senders. Every worker which got something is
+     * woken up once per batch. Workers' reports about admitted clients are applied before
+     * every batch is routed. */
+    [[noreturn]] void dispatch() {
+        RoomRouter router(workers_count * rooms_per_worker, chrono::milliseconds(TIMEOUT_MILLIS));
+        vector<bool> pushed(workers.size());
+        epoll_event event{};
+        size_t received;
 
-            char l_str[INET6_ADDRSTRLEN];
-            inet_ntop(AF_INET6, &client_addr, l_str, sizeof(l_str));
-            sendto(pol.fd, buffer, datagram.length(), 0,
-                   (sockaddr *) &client_addr, (socklen_t) sizeof(client_addr));
+        for (;;) {
+            if (epoll_wait(epoll_fd, &event, 1, -1) < 0 && errno != EINTR) {
+                exit_error("Epoll wait error");
+            }
+
+            do {
+                received = io->receive();
+                router.expire();
+                for (auto &worker: workers) {
+                    worker->report_admissions(router);
+                }
+                for (size_t i = 0; i < received; ++i) {
+                    if (!msg_from_client_valid(io->data(i), io->length(i))) {
+                        continue;
+                    }
+                    const Route &route = router.route(io->address(i));
+                    uint32_t worker = route.room / rooms_per_worker;
+                    if (workers[worker]->push(io->address(i), route, io->data(i),
+                                              io->length(i))) {
+                        pushed[worker] = true;
+                    }
+                }
+                for (size_t worker = 0; worker < workers.size(); ++worker) {
+                    if (pushed[worker]) {
+                        workers[worker]->wake();
+                        pushed[worker] = false;
+                    }
+                }
+            } while (received == IO_BATCH_SIZE);
         }
     }
 };
@@ -262,8 +382,11 @@ private:
 int main(int argc, char **argv) {
     Server server;
     if (!server.parse_args(argc, argv)) {
-        exit_error("Usage: " + string(argv[0]) + " -p port_num -s seed -t turning_speed "
-                   + "-v rounds_per_sec -w width -h height");
+        exit_error("Usage: " + string(argv[0]) + " [-p port_num] [-s seed] [-t turning_speed] "
+                   + "[-v rounds_per_sec] [-w width] [-h height] [-c workers] "
+                   + "[-r rooms_per_worker] [-u] [-i mmsg|uring] [-k burst|skip] "
+                   + "[-m max_catch_up] [-j snapshot_min_events] [-b retransmit_datagrams] "
+                   + "[-a client_rate] [-e egress_budget] [-x metrics_socket]");
     }
     server.prepare();
     server.run();
@@ -0,0 +1,235 @@
+#ifndef SCREEN_WORMS_SESSION_TABLE_H
+#define SCREEN_WORMS_SESSION_TABLE_H
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <chrono>
+#include <cstring>
+#include <netinet/in.h>
+#include "pacer.h"
+
+using namespace std;
+
+using SteadyTime = chrono::steady_clock::time_point;
+
+/* Part of every record kept for a client: its address and time of last activity. */
+class ClientRecord {
+public:
+    sockaddr_in6 addr{}; // Client address, ready to be used as destination
+    SteadyTime last_seen;
+    uint64_t key{}; // Distinguishes records of the same address in the timeout queue
+
+    /* Marks client as active now. */
+    void touch() {
+        last_seen = chrono::steady_clock::now();
+    }
+};
+
+/* Everything a room knows about a single connected client. */
+class Session : public ClientRecord {
+public:
+    uint64_t session_id{};
+    string player_name; // Empty for observers
+    SendQueue outbox; // Datagrams held back by pacing
+
+    Session() = default;
+
+    Session(uint64_t _session_id, string _player_name) :
+            session_id(_session_id),
+            player_name(std::move(_player_name)) {}
+};
+
+/* Room to which datagrams of a client are dispatched. */
+class Route : public ClientRecord {
+public:
+    uint32_t room{};
+    bool counted = false; // Client is counted among clients of the room
+
+    Route() = default;
+
+    explicit Route(uint32_t _room) : room(_room) {}
+};
+
+/* Entry of the timeout queue. Deadline may be outdated if the record was touched since
+ * the entry was pushed, it is then pushed again with the current deadline when reached. */
+class TimeoutEntry {
+public:
+    SteadyTime deadline;
+    sockaddr_in6 addr;
+    uint64_t key;
+
+    bool operator>(const TimeoutEntry &other) const {
+        return deadline > other.deadline;
+    }
+};
+
+/* Records of connected clients keyed by binary (in6_addr, port) pair. Records are kept
+ * densely in a vector, so iterating over all clients is a linear scan, and found through
+ * an open addressing hash index with linear probing.
+ *
+ * Inactive clients are expired using a min-heap of deadlines on the monotonic clock with
+ * exactly one entry per record. Touching a record does not update the heap, outdated
+ * entry is pushed again when it reaches the top, so expiring costs O(expired) work plus
+ * at most one refresh per client per timeout period. */
+template<typename Record>
+class ClientTable {
+private:
+    vector<Record> records;
+    vector<uint32_t> slots; // Index of record in records plus one, zero if slot is empty
+    size_t mask = 0;
+    chrono::milliseconds timeout;
+    priority_queue<TimeoutEntry, vector<TimeoutEntry>, greater<>> deadlines;
+    uint64_t next_key = 0;
+
+    static bool same_client(const sockaddr_in6 &left, const sockaddr_in6 &right) {
+        return left.sin6_port == right.sin6_port
+               && memcmp(&left.sin6_addr, &right.sin6_addr, sizeof(in6_addr)) == 0;
+    }
+
+    static size_t hash(const sockaddr_in6 &addr) {
+        uint64_t high, low;
+        memcpy(&high, addr.sin6_addr.s6_addr, sizeof(uint64_t));
+        memcpy(&low, addr.sin6_addr.s6_addr + sizeof(uint64_t), sizeof(uint64_t));
+        uint64_t h = (high ^ (low * 0x9e3779b97f4a7c15) ^ addr.sin6_port)
+                     * 0xff51afd7ed558ccd;
+        return h ^ (h >> 32);
+    }
+
+    /* Returns slot holding given client or the empty slot where it would be inserted. */
+    size_t find_slot(const sockaddr_in6 &addr) const {
+        size_t slot = hash(addr) & mask;
+        while (slots[slot] != 0 && !same_client(records[slots[slot] - 1].addr, addr)) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    /* Doubles index size when it becomes more than half full. */
+    void grow_if_needed() {
+        if (2 * (records.size() + 1) <= slots.size()) {
+            return;
+        }
+        slots.assign(max((size_t) 64, 2 * slots.size()), 0);
+        mask = slots.size() - 1;
+        for (size_t i = 0; i < records.size(); ++i) {
+            slots[find_slot(records[i].addr)] = i + 1;
+        }
+    }
+
+    /* Removes entries from the top of the heap which belong to removed records and pushes
+     * outdated ones again until top entry holds the real deadline of a live record. */
+    void refresh_top() {
+        while (!deadlines.empty()) {
+            TimeoutEntry entry = deadlines.top();
+            Record *record = find(entry.addr);
+            if (record == nullptr || record->key != entry.key) {
+                deadlines.pop();
+            }
+            else if (record->last_seen + timeout > entry.deadline) {
+                deadlines.pop();
+                entry.deadline = record->last_seen + timeout;
+                deadlines.push(entry);
+            }
+            else {
+                return;
+            }
+        }
+    }
+
+public:
+    explicit ClientTable(chrono::milliseconds _timeout) : timeout(_timeout) {
+        grow_if_needed();
+    }
+
+    /* Returns record of given client or nullptr if client is unknown. */
+    Record *find(const sockaddr_in6 &addr) {
+        size_t slot = find_slot(addr);
+        return slots[slot] == 0 ? nullptr : &records[slots[slot] - 1];
+    }
+
+    /* Adds record for client which is not in the table yet. Arguments following the
+     * address are passed to the record constructor. */
+    template<typename... Args>
+    Record &insert(const sockaddr_in6 &addr, Args &&... args) {
+        grow_if_needed();
+        records.emplace_back(std::forward<Args>(args)...);
+        Record &record = records.back();
+        record.addr.sin6_family = AF_INET6;
+        record.addr.sin6_port = addr.sin6_port;
+        record.addr.sin6_addr = addr.sin6_addr;
+        record.touch();
+        record.key = next_key++;
+        slots[find_slot(addr)] = records.size();
+        deadlines.push(TimeoutEntry{record.last_seen + timeout, record.addr, record.key});
+        return record;
+    }
+
+    /* Removes record of given client. Last record takes place of the removed one and
+     * following slots of the probe sequence are shifted back, so no tombstones are needed. */
+    void erase(const sockaddr_in6 &addr) {
+        size_t slot = find_slot(addr);
+        if (slots[slot] == 0) {
+            return;
+        }
+
+        size_t index = slots[slot] - 1;
+        if (index + 1 != records.size()) {
+            slots[find_slot(records.back().addr)] = index + 1;
+            records[index] = std::move(records.back());
+        }
+        records.pop_back();
+
+        size_t hole = slot, next = (slot + 1) & mask;
+        slots[hole] = 0;
+        while (slots[next] != 0) {
+            size_t home = hash(records[slots[next] - 1].addr) & mask;
+            // Entry may fill the hole unless its home slot lies cyclically in (hole, next].
+            if (((next - home) & mask) >= ((next - hole) & mask)) {
+                slots[hole] = slots[next];
+                slots[next] = 0;
+                hole = next;
+            }
+            next = (next + 1) & mask;
+        }
+    }
+
+    /* Removes records of clients inactive for at least timeout, calling on_expired for each
+     * of them before it is removed. */
+    template<typename Callback>
+    void expire(Callback on_expired) {
+        SteadyTime now = chrono::steady_clock::now();
+        refresh_top();
+        while (!deadlines.empty() && deadlines.top().deadline <= now) {
+            sockaddr_in6 addr = deadlines.top().addr;
+            deadlines.pop();
+            on_expired(*find(addr));
+            erase(addr);
+            refresh_top();
+        }
+    }
+
+    /* Returns the earliest moment some client may expire or maximal time point if there
+     * are no clients. */
+    SteadyTime next_deadline() {
+        refresh_top();
+        return deadlines.empty() ? SteadyTime::max() : deadlines.top().deadline;
+    }
+
+    size_t size() const {
+        return records.size();
+    }
+
+    typename vector<Record>::iterator begin() {
+        return records.begin();
+    }
+
+    typename vector<Record>::iterator end() {
+        return records.end();
+    }
+};
+
+using SessionTable = ClientTable<Session>;
+using RouteTable = ClientTable<Route>;
+
+#endif //SCREEN_WORMS_SESSION_TABLE_H
@@ -0,0 +1,176 @@
+#ifndef SCREEN_WORMS_SNAPSHOT_H
+#define SCREEN_WORMS_SNAPSHOT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../common/const.h"
+#include "../common/events.h"
+#include "../common/event_log.h"
+#include "../utils/wire.h"
+
+// Runs fitting into a datagram together with game_id and the rest of snapshot event.
+#define SNAPSHOT_CHUNK_RUNS ((DATAGRAM_SIZE - 6 * sizeof(uint32_t) - 3 * sizeof(uint8_t)) \
+                             / SNAPSHOT_RUN_SIZE)
+// Snapshot events, each filling a datagram, a snapshot may consist of. Every run holds at
+// least one eaten pixel, so snapshots of games with up to SNAPSHOT_MAX_PARTS *
+// SNAPSHOT_CHUNK_RUNS eaten pixels always fit. Snapshot is sent whole, so together with
+// NEW_GAME it has to fit into the send queue of a client.
+#define SNAPSHOT_MAX_PARTS 128
+#define SNAPSHOT_REFRESH_EVENTS 512 // Events after the snapshot that trigger a new one
+#define SNAPSHOT_FREE 255 // Owner of pixels not eaten by any player
+
+static_assert(SNAPSHOT_MAX_PARTS <= UINT8_MAX, "Snapshot parts are numbered in a byte");
+
+using namespace std;
+
+/* Catch-up for clients which missed much of the current game. Instead of the whole event
+ * history they get the NEW_GAME event, snapshot of eaten pixels split into datagram sized
+ * SNAPSHOT events and events appended after the snapshot was taken, all kept together in
+ * one log. Owners of pixels are replayed from the game's log lazily, only when a snapshot
+ * is requested, so games nobody joins late pay nothing. Snapshot is retaken once enough
+ * events follow it. Once the eaten pixels do not fit into SNAPSHOT_MAX_PARTS, there is no
+ * snapshot until the next game, as pixels are never freed. */
+class BoardSnapshot {
+private:
+    vector<uint8_t> owners; // Player who ate the pixel or SNAPSHOT_FREE, row-major
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t eliminated = 0;
+    size_t applied = 0; // Events of game log replayed into owners
+    size_t covered = 0; // Events of game log described by the snapshot, 0 - no snapshot
+    size_t copied = 0; // Events of game log present in catch_up
+    size_t head = 0; // Events of catch_up forming NEW_GAME and the snapshot
+    bool oversized = false; // Snapshot would exceed SNAPSHOT_MAX_PARTS
+    EventLog catch_up;
+
+    /* Replays events of the game log which were not replayed yet. */
+    void apply(const EventLog &log) {
+        for (; applied < log.size(); ++applied) {
+            ByteReader reader(log.data(applied), log.length(applied));
+            EventView event = EventView::read(reader);
+            if (event.event_type == NEW_GAME) {
+                width = event.maxx;
+                height = event.maxy;
+                owners.assign((size_t) width * height, SNAPSHOT_FREE);
+                eliminated = 0;
+            }
+            else if (event.event_type == PIXEL) {
+                owners[(size_t) event.y * width + event.x] = event.player_number;
+            }
+            else if (event.event_type == PLAYER_ELIMINATED) {
+                eliminated |= (uint32_t) 1 << event.player_number;
+            }
+        }
+    }
+
+    /* Returns number of runs of eaten pixels with the same owner on the board. */
+    size_t count_runs() const {
+        size_t runs = 0;
+        for (size_t pixel = 0; pixel < owners.size(); ++pixel) {
+            if (owners[pixel] != SNAPSHOT_FREE
+                && (pixel == 0 || owners[pixel - 1] != owners[pixel])) {
+                ++runs;
+            }
+        }
+        return runs;
+    }
+
+    /* Appends snapshot event of the next part with given runs. Catch-up log holds NEW_GAME
+     * before the parts. */
+    void append_part(size_t parts, uint32_t first_pixel, const string &runs) {
+        catch_up.append_snapshot(covered - 1, catch_up.size() - 1, parts, eliminated,
+                                 first_pixel, runs);
+    }
+
+    /* Appends run of eaten pixels to runs, closing full snapshot event first. Snapshot
+     * event starts at its first run, except for the first one which starts at pixel 0. */
+    void add_run(string &runs, size_t parts, uint32_t &first_pixel, uint32_t &next_pixel,
+                 uint32_t pixel, uint8_t owner, uint32_t length) {
+        if (runs.size() == SNAPSHOT_CHUNK_RUNS * SNAPSHOT_RUN_SIZE) {
+            append_part(parts, first_pixel, runs);
+            runs.clear();
+            first_pixel = next_pixel = pixel;
+        }
+        char run[SNAPSHOT_RUN_SIZE];
+        ByteWriter writer(run, SNAPSHOT_RUN_SIZE);
+        writer.write8(owner);
+        writer.write32(pixel - next_pixel);
+        writer.write32(length);
+        runs.append(run, SNAPSHOT_RUN_SIZE);
+        next_pixel = pixel + length;
+    }
+
+    /* Takes snapshot of the board after all events of the game log. Only eaten pixels are
+     * described, number of parts is known before they are written. Snapshot without eaten
+     * pixels has a single empty part, which still reports eliminations. */
+    void take(const EventLog &log) {
+        apply(log);
+        covered = log.size();
+        size_t parts = max((size_t) 1, (count_runs() + SNAPSHOT_CHUNK_RUNS - 1)
+                                       / SNAPSHOT_CHUNK_RUNS);
+        if (parts > SNAPSHOT_MAX_PARTS) {
+            oversized = true;
+            return;
+        }
+        catch_up.clear();
+        catch_up.append_encoded(log.data(0), log.length(0));
+
+        string runs;
+        uint32_t first_pixel = 0, next_pixel = 0, pixel = 0, pixels = owners.size();
+        while (pixel < pixels) {
+            uint32_t end = pixel + 1;
+            while (end < pixels && owners[end] == owners[pixel]) {
+                ++end;
+            }
+            if (owners[pixel] != SNAPSHOT_FREE) {
+                add_run(runs, parts, first_pixel, next_pixel, pixel, owners[pixel], end - pixel);
+            }
+            pixel = end;
+        }
+        append_part(parts, first_pixel, runs);
+        head = catch_up.size();
+        copied = covered;
+    }
+
+public:
+    BoardSnapshot() = default;
+
+    /* Forgets snapshot of the previous game, memory is kept. */
+    void reset() {
+        catch_up.clear();
+        applied = 0;
+        covered = 0;
+        copied = 0;
+        head = 0;
+        oversized = false;
+    }
+
+    /* Returns catch-up log for non-empty game log, retaking snapshot if needed and copying
+     * events appended since. Returns nullptr if the snapshot would be too long. */
+    const EventLog *update(const EventLog &log) {
+        if (!oversized && (covered == 0 || log.size() - covered > SNAPSHOT_REFRESH_EVENTS)) {
+            take(log);
+        }
+        if (oversized) {
+            return nullptr;
+        }
+        for (; copied < log.size(); ++copied) {
+            catch_up.append_encoded(log.data(copied), log.length(copied));
+        }
+        return &catch_up;
+    }
+
+    /* Number of events at the start of catch-up log which form NEW_GAME and the snapshot,
+     * each of them in a datagram of its own. */
+    size_t head_size() const {
+        return head;
+    }
+
+    /* Number of events of game log described by the last snapshot. */
+    size_t covered_events() const {
+        return covered;
+    }
+};
+
+#endif //SCREEN_WORMS_SNAPSHOT_H
@@ -0,0 +1,53 @@
+#ifndef SCREEN_WORMS_SPSC_QUEUE_H
+#define SCREEN_WORMS_SPSC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+using namespace std;
+
+/* Bounded lock-free queue for exactly one producer thread and one consumer thread.
+ * Capacity must be a power of two. Head and tail live on separate cache lines, so the two
+ * threads only share a line when one of them reads the other's position. */
+template<typename T>
+class SpscQueue {
+private:
+    vector<T> slots;
+    size_t mask;
+    alignas(64) atomic<size_t> head{0}; // Next slot to pop, written by consumer
+    alignas(64) atomic<size_t> tail{0}; // Next slot to push, written by producer
+
+public:
+    explicit SpscQueue(size_t capacity) : slots(capacity), mask(capacity - 1) {}
+
+    /* Returns slot where next element should be written or nullptr if queue is full.
+     * Element becomes visible to consumer after commit_push. Producer only. */
+    T *begin_push() {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t - head.load(memory_order_acquire) == slots.size()) {
+            return nullptr;
+        }
+        return &slots[t & mask];
+    }
+
+    void commit_push() {
+        tail.store(tail.load(memory_order_relaxed) + 1, memory_order_release);
+    }
+
+    /* Returns oldest element or nullptr if queue is empty. Element stays valid until
+     * commit_pop. Consumer only. */
+    T *front() {
+        size_t h = head.load(memory_order_relaxed);
+        if (h == tail.load(memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots[h & mask];
+    }
+
+    void commit_pop() {
+        head.store(head.load(memory_order_relaxed) + 1, memory_order_release);
+    }
+};
+
+#endif //SCREEN_WORMS_SPSC_QUEUE_H
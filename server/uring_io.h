@@ -0,0 +1,421 @@
+#ifndef SCREEN_WORMS_URING_IO_H
+#define SCREEN_WORMS_URING_IO_H
+
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "../common/exceptions.h"
+#include "datagram_io.h"
+
+#define URING_ENTRIES 256
+#define URING_CQ_ENTRIES 4096
+#define URING_BUFFERS 512 // Power of two, required by buffer ring
+#define URING_BUFFER_GROUP 0
+#define URING_RECV_TAG 1
+#define URING_SEND_TAG 2
+#define URING_TAG_MASK 0xff
+#define URING_SLOT_SHIFT 8 // Send requests keep their slot in the submission above the tag
+
+using namespace std;
+
+/* Backend built on io_uring, used through raw system calls. Socket is read by a single
+ * multishot recvmsg request which stays armed across datagrams and picks buffers from a
+ * ring registered with the kernel, so receiving costs no system call as long as the request
+ * is armed. Datagrams of a tick are sent as one sendmsg request each, or one per run of
+ * datagrams segmented by the kernel, submitted together. Datagrams of a segmented send
+ * which the kernel could not segment are sent again one by one.
+ *
+ * Every completion is signalled on an eventfd, which is what the event loop should wait
+ * for. Signals of send completions are cleared at the end of flush, so they do not wake the
+ * loop up. */
+class UringIo : public DatagramIo {
+private:
+    /* Datagram completed by the receive request, kept in buffer number bid until the
+     * buffer is given back to the kernel. */
+    class Received {
+    public:
+        const char *data;
+        size_t length;
+        const sockaddr_in6 *addr;
+        uint16_t bid;
+    };
+
+    static constexpr size_t buffer_size = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in6)
+                                          + DATAGRAM_SIZE;
+
+    int ring_fd = -1;
+    int event_fd = -1;
+    unsigned sq_entries = 0;
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+    void *rings = MAP_FAILED;
+    size_t rings_size = 0;
+    size_t sqes_size = 0;
+    unsigned to_submit = 0;
+
+    io_uring_buf_ring *buf_ring = nullptr;
+    size_t buf_ring_size = 0;
+    uint16_t buf_tail = 0;
+    vector<char> buffers;
+
+    msghdr recv_hdr{};
+    bool receiving = false;
+    bool recv_armed = false;
+    vector<Received> batch;
+    deque<Received> backlog; // Reaped but not yet returned by receive
+    size_t sends_in_flight = 0;
+
+    vector<msghdr> snd_hdrs;
+    vector<iovec> snd_iovs;
+    vector<char> snd_controls;
+    vector<pair<size_t, size_t>> snd_runs; // First queued datagram and count of each send
+    vector<size_t> resend; // Queued datagrams to be sent again one by one
+
+    static int uring_setup(unsigned entries, io_uring_params *params) {
+        return (int) syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    static int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+        return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+    }
+
+    /* Submits prepared requests and waits until at least wait_for completions are posted. */
+    void enter(unsigned wait_for) {
+        int ret;
+        do {
+            ++stats.syscalls;
+            ret = (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_for,
+                                wait_for > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        } while (ret < 0 && errno == EINTR);
+        if (ret > 0) {
+            to_submit -= min((unsigned) ret, to_submit);
+        }
+    }
+
+    /* Returns cleared submission queue entry, submitting pending ones if queue is full. */
+    io_uring_sqe *get_sqe() {
+        unsigned tail = *sq_tail;
+        while (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries) {
+            enter(0);
+        }
+        unsigned index = tail & *sq_mask;
+        sq_array[index] = index;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(io_uring_sqe));
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++to_submit;
+        return sqe;
+    }
+
+    /* Makes buffer number bid available to the receive request again. Buffer is published
+     * to the kernel by publish_buffers. */
+    void add_buffer(uint16_t bid) {
+        // Ring is indexed by hand, in C++ the flexible bufs member of io_uring_buf_ring does
+        // not start at offset zero. Only these fields may be written, reserved field of the
+        // first entry is ring tail.
+        io_uring_buf &buf = ((io_uring_buf *) buf_ring)[buf_tail & (URING_BUFFERS - 1)];
+        buf.addr = (uint64_t) &buffers[bid * buffer_size];
+        buf.len = buffer_size;
+        buf.bid = bid;
+        ++buf_tail;
+    }
+
+    void publish_buffers() {
+        __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+    }
+
+    void arm_receive() {
+        io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = sock;
+        sqe->addr = (uint64_t) &recv_hdr;
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->user_data = URING_RECV_TAG;
+        recv_armed = true;
+    }
+
+    void clear_wakeup() {
+        uint64_t counter;
+        ++stats.syscalls;
+        (void) !read(event_fd, &counter, sizeof(counter));
+    }
+
+    /* Consumes all posted completions. Received datagrams are put into backlog. */
+    void reap() {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe &cqe = cqes[head & *cq_mask];
+            if ((cqe.user_data & URING_TAG_MASK) == URING_SEND_TAG) {
+                --sends_in_flight;
+                const pair<size_t, size_t> &run = snd_runs[cqe.user_data >> URING_SLOT_SHIFT];
+                if (cqe.res >= 0) {
+                    stats.datagrams_out += run.second;
+                    stats.gso_sends += run.second > 1;
+                }
+                else if (run.second > 1 && cannot_segment(-cqe.res)) {
+                    for (size_t i = 0; i < run.second; ++i) {
+                        resend.push_back(run.first + i);
+                    }
+                }
+                continue;
+            }
+
+            if (!(cqe.flags & IORING_CQE_F_MORE)) { // Request finished, e.g. out of buffers.
+                recv_armed = false;
+            }
+            if (cqe.res < 0 || !(cqe.flags & IORING_CQE_F_BUFFER)) {
+                continue;
+            }
+            auto bid = (uint16_t) (cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            const char *buffer = &buffers[bid * buffer_size];
+            io_uring_recvmsg_out out{};
+            memcpy(&out, buffer, sizeof(out));
+            size_t offset = sizeof(out) + recv_hdr.msg_namelen;
+            backlog.push_back(Received{buffer + offset,
+                                       min((size_t) out.payloadlen, buffer_size - offset),
+                                       (const sockaddr_in6 *) (buffer + sizeof(out)), bid});
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    void close_all() {
+        if (buf_ring != nullptr) {
+            munmap(buf_ring, buf_ring_size);
+        }
+        if (sqes != nullptr) {
+            munmap(sqes, sqes_size);
+        }
+        if (rings != MAP_FAILED) {
+            munmap(rings, rings_size);
+        }
+        if (event_fd >= 0) {
+            close(event_fd);
+        }
+        if (ring_fd >= 0) {
+            close(ring_fd);
+        }
+    }
+
+public:
+    /* Sets up the ring. Throws IoBackendException if io_uring or a feature it needs is not
+     * available. */
+    UringIo() : buffers(URING_BUFFERS * buffer_size) {
+        io_uring_params params{};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = URING_CQ_ENTRIES;
+        ring_fd = uring_setup(URING_ENTRIES, &params);
+        if (ring_fd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+            close_all();
+            throw IoBackendException("io_uring setup failed");
+        }
+
+        sq_entries = params.sq_entries;
+        rings_size = max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                         params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        rings = mmap(nullptr, rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring_fd, IORING_OFF_SQ_RING);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (rings == MAP_FAILED || sqes_map == MAP_FAILED) {
+            close_all();
+            throw IoBackendException("io_uring mmap failed");
+        }
+        sqes = (io_uring_sqe *) sqes_map;
+        char *base = (char *) rings;
+        sq_head = (unsigned *) (base + params.sq_off.head);
+        sq_tail = (unsigned *) (base + params.sq_off.tail);
+        sq_mask = (unsigned *) (base + params.sq_off.ring_mask);
+        sq_array = (unsigned *) (base + params.sq_off.array);
+        cq_head = (unsigned *) (base + params.cq_off.head);
+        cq_tail = (unsigned *) (base + params.cq_off.tail);
+        cq_mask = (unsigned *) (base + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe *) (base + params.cq_off.cqes);
+
+        buf_ring_size = URING_BUFFERS * sizeof(io_uring_buf);
+        void *buf_map = mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf_map == MAP_FAILED) {
+            close_all();
+            throw IoBackendException("io_uring buffer ring mmap failed");
+        }
+        buf_ring = (io_uring_buf_ring *) buf_map;
+        io_uring_buf_reg reg{};
+        reg.ring_addr = (uint64_t) buf_ring;
+        reg.ring_entries = URING_BUFFERS;
+        reg.bgid = URING_BUFFER_GROUP;
+        if (uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            close_all();
+            throw IoBackendException("io_uring buffer ring registration failed");
+        }
+        for (uint16_t bid = 0; bid < URING_BUFFERS; ++bid) {
+            add_buffer(bid);
+        }
+        publish_buffers();
+
+        event_fd = eventfd(0, EFD_NONBLOCK);
+        if (event_fd < 0 || uring_register(ring_fd, IORING_REGISTER_EVENTFD,
+                                           &event_fd, 1) < 0) {
+            close_all();
+            throw IoBackendException("io_uring eventfd registration failed");
+        }
+
+        recv_hdr.msg_namelen = sizeof(sockaddr_in6);
+        snd_hdrs.resize(sq_entries);
+        snd_iovs.resize(sq_entries * GSO_MAX_SEGMENTS);
+        snd_controls.resize(sq_entries * GSO_CONTROL_SIZE);
+        snd_runs.resize(sq_entries);
+    }
+
+    UringIo(const UringIo &) = delete;
+
+    UringIo &operator=(const UringIo &) = delete;
+
+    ~UringIo() override {
+        close_all();
+    }
+
+    /* Arms the receive request if receiving. Throws IoBackendException if kernel rejects
+     * it, which happens right at submission. */
+    void attach(int _sock, bool _receiving) override {
+        DatagramIo::attach(_sock, _receiving);
+        receiving = _receiving;
+        if (receiving) {
+            arm_receive();
+            enter(0);
+            reap();
+            if (!recv_armed) {
+                throw IoBackendException("io_uring multishot receive not supported");
+            }
+        }
+    }
+
+    int wait_fd() const override {
+        return event_fd;
+    }
+
+    size_t receive() override {
+        for (auto &datagram: batch) {
+            add_buffer(datagram.bid);
+        }
+        if (!batch.empty()) {
+            publish_buffers();
+            batch.clear();
+        }
+
+        clear_wakeup();
+        if (receiving && !recv_armed) { // Stopped when it ran out of buffers.
+            arm_receive();
+            enter(0);
+        }
+        reap();
+
+        while (!backlog.empty() && batch.size() < IO_BATCH_SIZE) {
+            batch.push_back(backlog.front());
+            backlog.pop_front();
+        }
+        stats.datagrams_in += batch.size();
+        return batch.size();
+    }
+
+    const char *data(size_t i) const override {
+        return batch[i].data;
+    }
+
+    size_t length(size_t i) const override {
+        return batch[i].length;
+    }
+
+    const sockaddr_in6 &address(size_t i) const override {
+        return *batch[i].addr;
+    }
+
+    /* Submits send requests at most a submission queue at a time and waits for their
+     * completions, so payloads may be reused by the next tick. Datagrams put back for
+     * resending go first in the next submission. */
+    void flush() override {
+        size_t sent = 0;
+        while (sent < queued.size() || !resend.empty()) {
+            size_t count = 0, iovs = 0;
+            for (; count < sq_entries && (sent < queued.size() || !resend.empty()); ++count) {
+                pair<size_t, size_t> &run = snd_runs[count];
+                if (!resend.empty()) {
+                    run = {resend.back(), 1};
+                    resend.pop_back();
+                }
+                else {
+                    run = {sent, segment_run(sent)};
+                    sent += run.second;
+                }
+                prepare_send(run.first, run.second, snd_hdrs[count], &snd_iovs[iovs],
+                             &snd_controls[count * GSO_CONTROL_SIZE]);
+
+                io_uring_sqe *sqe = get_sqe();
+                sqe->opcode = IORING_OP_SENDMSG;
+                sqe->fd = sock;
+                sqe->addr = (uint64_t) &snd_hdrs[count];
+                sqe->len = 1;
+                sqe->user_data = URING_SEND_TAG | (count << URING_SLOT_SHIFT);
+                iovs += run.second;
+            }
+            sends_in_flight += count;
+
+            enter(count);
+            reap();
+            while (sends_in_flight > 0) {
+                enter(1);
+                reap();
+            }
+        }
+
+        if (!queued.empty()) {
+            // Completions posted before the signal is cleared are reaped here. Loop must still
+            // wake up for datagrams among them.
+            clear_wakeup();
+            reap();
+            if (!backlog.empty()) {
+                uint64_t one = 1;
+                (void) !write(event_fd, &one, sizeof(one));
+            }
+        }
+        end_tick();
+    }
+};
+
+/* Returns I/O layer using given backend on given socket. Falls back to recvmmsg backend if
+ * io_uring cannot be used, which is reported with the reason on standard error. */
+inline unique_ptr<DatagramIo> open_datagram_io(IoBackend backend, int sock, bool receiving) {
+    if (backend == IO_URING) {
+        try {
+            auto io = make_unique<UringIo>();
+            io->attach(sock, receiving);
+            return io;
+        }
+        catch (IoBackendException &e) { // recvmmsg is always available.
+            cerr << "Using recvmmsg backend instead of io_uring: " << e.what() << endl;
+        }
+    }
+    auto io = make_unique<MmsgIo>();
+    io->attach(sock, receiving);
+    return io;
+}
+
+#endif //SCREEN_WORMS_URING_IO_H
@@ -0,0 +1,267 @@
+#ifndef SCREEN_WORMS_WORKER_H
+#define SCREEN_WORMS_WORKER_H
+
+#include <vector>
+#include <cstring>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include "../utils/util_func.h"
+#include "datagram_io.h"
+#include "uring_io.h"
+#include "room.h"
+#include "room_router.h"
+#include "spsc_queue.h"
+#include "worker_metrics.h"
+
+#define INBOX_CAPACITY 4096
+#define MAX_EPOLL_EVENTS 2
+
+using namespace std;
+
+/* Client datagram passed from dispatcher to the worker owning its room. */
+class InboundDatagram {
+public:
+    sockaddr_in6 addr;
+    uint32_t room;
+    uint32_t size;
+    bool counted; // Router counts the client in the room
+    char data[MAX_CLIENT_MSG_LEN];
+};
+
+/* Room's answer to a client the dispatcher counted wrongly, passed back to its router. */
+class Admission {
+public:
+    sockaddr_in6 addr;
+    uint32_t room;
+    bool admitted;
+};
+
+/* Event loop running a group of rooms on a single thread. Worker either receives datagrams
+ * from the socket itself and routes them to its rooms (direct mode, used when there is just
+ * one worker) or gets them already routed by dispatcher through its inbox. In both cases
+ * only the worker's thread touches its rooms, answers are sent through its own I/O layer
+ * on the shared socket. */
+class Worker {
+private:
+    vector<Room> rooms;
+    uint32_t first_room; // Global number of rooms[0]
+    bool direct;
+    unique_ptr<DatagramIo> io;
+    RoomRouter router; // Direct mode only
+    SpscQueue<InboundDatagram> inbox = SpscQueue<InboundDatagram>(INBOX_CAPACITY);
+    SpscQueue<Admission> admissions = SpscQueue<Admission>(INBOX_CAPACITY);
+    int event_fd = -1;
+    int epoll_fd = -1;
+    int timer_fd = -1;
+    WorkerMetrics metrics;
+    SteadyTime next_gauges; // When clients and events are counted next time
+
+    void watch_fd(int fd) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            exit_error("Epoll ctl error");
+        }
+    }
+
+    /* Sets timer to fire when next round or client timeout of any room is due. Timer is
+     * disarmed if none is pending so that worker sleeps until next datagram. */
+    void arm_timer() {
+        itimerspec spec{};
+        auto left = chrono::nanoseconds::max();
+        for (auto &room: rooms) {
+            left = min(left, room.time_to_next_event());
+        }
+
+        if (left != chrono::nanoseconds::max()) {
+            auto nanos = max(left.count(), (int64_t) 1); // Zero would disarm the timer.
+            spec.it_value.tv_sec = nanos / 1000000000;
+            spec.it_value.tv_nsec = nanos % 1000000000;
+        }
+        if (timerfd_settime(timer_fd, 0, &spec, nullptr) < 0) {
+            exit_error("Timerfd settime error");
+        }
+    }
+
+    /* Reads all waiting datagrams from the socket and passes valid ones to their rooms.
+     * Batch which is not full means there is nothing more to read. */
+    void receive_direct() {
+        size_t received;
+        do {
+            received = io->receive();
+            router.expire();
+            for (size_t i = 0; i < received; ++i) {
+                if (!msg_from_client_valid(io->data(i), io->length(i))) {
+                    continue;
+                }
+                const sockaddr_in6 &client_addr = io->address(i);
+                const Route &route = router.route(client_addr);
+                uint32_t room = route.room;
+                bool counted = route.counted;
+                if (rooms[room].handle_datagram(client_addr, io->data(i), io->length(i), *io)
+                    != counted) {
+                    router.report(client_addr, room, !counted);
+                }
+            }
+        } while (received == IO_BATCH_SIZE);
+    }
+
+    /* Counts clients per state and events of current games of all rooms. It takes a pass
+     * over all players, so it is done only every METRICS_GAUGES_MILLIS. */
+    void update_gauges(SteadyTime now) {
+        if (now < next_gauges) {
+            return;
+        }
+        next_gauges = now + chrono::milliseconds(METRICS_GAUGES_MILLIS);
+
+        uint64_t states[CLIENT_STATES] = {}, log_events = 0, log_bytes = 0;
+        for (auto &room: rooms) {
+            room.count_clients(states, log_events, log_bytes);
+        }
+        for (int state = 0; state < CLIENT_STATES; ++state) {
+            metrics.clients[state].set(states[state]);
+        }
+        metrics.log_events.set(log_events);
+        metrics.log_bytes.set(log_bytes);
+    }
+
+    /* Passes datagrams routed by dispatcher to their rooms. Dispatcher is told about clients
+     * it counted in a room which turned them away and the other way round. If the queue
+     * is full the report is dropped, client is then miscounted until it times out. */
+    void receive_inbox() {
+        InboundDatagram *datagram;
+        while ((datagram = inbox.front()) != nullptr) {
+            bool admitted = rooms[datagram->room - first_room].handle_datagram(
+                    datagram->addr, datagram->data, datagram->size, *io);
+            Admission *admission;
+            if (admitted != datagram->counted && (admission = admissions.begin_push())) {
+                admission->addr = datagram->addr;
+                admission->room = datagram->room;
+                admission->admitted = admitted;
+                admissions.commit_push();
+            }
+            inbox.commit_pop();
+        }
+    }
+
+public:
+    Worker(vector<Room> _rooms, uint32_t _first_room, int _sock, bool _direct,
+           IoBackend backend, size_t egress_budget) :
+            rooms(std::move(_rooms)),
+            first_room(_first_room),
+            direct(_direct),
+            router(rooms.size(), chrono::milliseconds(TIMEOUT_MILLIS)) {
+        io = open_datagram_io(backend, _sock, direct);
+        io->egress_budget = egress_budget;
+        for (auto &room: rooms) {
+            room.attach_metrics(metrics);
+        }
+
+        event_fd = eventfd(0, EFD_NONBLOCK);
+        if (event_fd < 0) {
+            exit_error("Eventfd error");
+        }
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (timer_fd < 0) {
+            exit_error("Timerfd error");
+        }
+        epoll_fd = epoll_create1(0);
+        if (epoll_fd < 0) {
+            exit_error("Epoll error");
+        }
+        watch_fd(direct ? io->wait_fd() : event_fd);
+        watch_fd(timer_fd);
+    }
+
+    Worker(const Worker &) = delete;
+
+    Worker &operator=(const Worker &) = delete;
+
+    /* Passes datagram to the worker. Returns false if the inbox is full, datagram is then
+     * dropped as it would be by a congested network. Dispatcher thread only. */
+    bool push(const sockaddr_in6 &client_addr, const Route &route, const char *buffer,
+              size_t size) {
+        InboundDatagram *datagram = inbox.begin_push();
+        if (datagram == nullptr) {
+            return false;
+        }
+        datagram->addr = client_addr;
+        datagram->room = route.room;
+        datagram->counted = route.counted;
+        datagram->size = size;
+        memcpy(datagram->data, buffer, size);
+        inbox.commit_push();
+        return true;
+    }
+
+    /* Passes rooms' reports about admitted and turned away clients to the router.
+     * Dispatcher thread only. */
+    void report_admissions(RoomRouter &router) {
+        Admission *admission;
+        while ((admission = admissions.front()) != nullptr) {
+            router.report(admission->addr, admission->room, admission->admitted);
+            admissions.commit_pop();
+        }
+    }
+
+    /* Metrics of the worker and its rooms, safe to read from any thread. */
+    const WorkerMetrics &get_metrics() const {
+        return metrics;
+    }
+
+    /* Counters of the worker's I/O layer, safe to read from any thread. */
+    const IoStats &io_stats() const {
+        return io->stats;
+    }
+
+    /* Wakes the worker up to process pushed datagrams. */
+    void wake() {
+        uint64_t one = 1;
+        (void) !write(event_fd, &one, sizeof(one));
+    }
+
+    /* Worker main loop. Sleeps until datagram arrives or next round or client timeout of
+     * some room is due, then handles all incoming datagrams, runs cyclical game activities
+     * of every room and sends answer datagrams. Time of every such pass is measured. */
+    [[noreturn]] void run() {
+        epoll_event events[MAX_EPOLL_EVENTS];
+        uint64_t counter;
+
+        for (;;) {
+            arm_timer();
+            int ret = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+            if (ret < 0 && errno != EINTR) {
+                exit_error("Epoll wait error");
+            }
+            SteadyTime start = chrono::steady_clock::now();
+
+            for (int i = 0; i < ret; ++i) {
+                if (direct && events[i].data.fd == io->wait_fd()) {
+                    receive_direct();
+                }
+                else { // Timer or event fd, only needs to be reset.
+                    (void) !read(events[i].data.fd, &counter, sizeof(counter));
+                }
+            }
+            if (!direct) {
+                receive_inbox();
+            }
+
+            for (auto &room: rooms) {
+                room.run_round(*io);
+            }
+            io->flush();
+
+            SteadyTime end = chrono::steady_clock::now();
+            metrics.tick_duration.record(chrono::duration_cast<chrono::nanoseconds>(
+                    end - start).count());
+            update_gauges(end);
+        }
+    }
+};
+
+#endif //SCREEN_WORMS_WORKER_H
@@ -0,0 +1,48 @@
+#ifndef SCREEN_WORMS_WORKER_METRICS_H
+#define SCREEN_WORMS_WORKER_METRICS_H
+
+#include "../utils/metrics.h"
+
+#define METRICS_GAUGES_MILLIS 1000 // How often workers count their clients and events
+
+using namespace std;
+
+/* What a client is doing, clients are counted per state. */
+enum ClientState {
+    CLIENT_WAITING, // Player which has not pressed a key since the last game
+    CLIENT_READY,
+    CLIENT_PLAYING, // Player with a worm in the running game, possibly already eliminated
+    CLIENT_OBSERVER,
+    CLIENT_STATES
+};
+
+static const char *const CLIENT_STATE_NAMES[] = {"waiting", "ready", "playing", "observer"};
+
+/* Measurements of games of a group of rooms, recorded by their game managers. */
+class GameMetrics {
+public:
+    LatencyHistogram round_lateness; // Nanoseconds between deadline of round and its start
+    Counter rounds;
+    Counter skipped_rounds;
+    Counter games;
+    Counter events;
+};
+
+/* Everything measured by a single worker and its rooms. Written only by the worker's
+ * thread, so recording costs about as much as updating plain integers, and read by the
+ * metrics exporter at any time. */
+class WorkerMetrics {
+public:
+    GameMetrics game;
+    LatencyHistogram tick_duration; // Nanoseconds of a single pass of the worker loop
+    Counter sent_bytes; // Sent at once, without queueing
+    Counter queued_bytes;
+    Counter paced_bytes;
+    Counter dropped_bytes;
+    Counter retransmit_bytes; // Answers to clients' requests for missed events
+    Gauge clients[CLIENT_STATES];
+    Gauge log_events; // Events in logs of current games
+    Gauge log_bytes;
+};
+
+#endif //SCREEN_WORMS_WORKER_METRICS_H
@@ -0,0 +1,104 @@
+#ifndef SCREEN_WORMS_WORMS_H
+#define SCREEN_WORMS_WORMS_H
+
+#include <cstdint>
+#include <cstring>
+#include "../common/const.h"
+#include "directions.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define WORMS_CAPACITY 32 // PLAYERS_LIMIT rounded up to whole SIMD batches
+#define WORMS_BATCH 4
+
+using namespace std;
+
+/* State of worms of the current game needed every round, one column per field, indexed by
+ * player number. Kernels update all worms of the game at once, including eliminated ones,
+ * whose values are simply never read again. Slots behind the last worm are kept zeroed, so
+ * kernels can always process whole batches. */
+class Worms {
+public:
+    uint32_t count = 0; // Worms in current game
+    alignas(16) double x[WORMS_CAPACITY]{};
+    alignas(16) double y[WORMS_CAPACITY]{};
+    alignas(16) int32_t direction[WORMS_CAPACITY]{}; // Degrees, [0, 360)
+    alignas(16) int32_t turn[WORMS_CAPACITY]{}; // 0 - straight, 1 - right, 2 - left
+    alignas(16) int32_t moved[WORMS_CAPACITY]{}; // Non zero if worm entered a new pixel
+    alignas(16) double step_x[WORMS_CAPACITY]{};
+    alignas(16) double step_y[WORMS_CAPACITY]{};
+    bool alive[WORMS_CAPACITY]{};
+
+    /* Removes all worms and prepares room for worms of a new game. */
+    void reset(uint32_t _count) {
+        *this = Worms();
+        count = _count;
+    }
+
+    /* Number of slots kernels process, whole batches covering all worms. */
+    uint32_t batched() const {
+        return (count + WORMS_BATCH - 1) / WORMS_BATCH * WORMS_BATCH;
+    }
+
+    /* Turns every worm by turning_speed degrees in its turn direction. */
+    void turn_all(uint32_t turning_speed) {
+#if defined(__SSE2__)
+        __m128i speed = _mm_set1_epi32(turning_speed), full = _mm_set1_epi32(360);
+        __m128i zero = _mm_setzero_si128(), right = _mm_set1_epi32(1), left = _mm_set1_epi32(2);
+        for (uint32_t i = 0; i < batched(); i += WORMS_BATCH) {
+            __m128i dir = _mm_load_si128((const __m128i *) &direction[i]);
+            __m128i to = _mm_load_si128((const __m128i *) &turn[i]);
+            dir = _mm_add_epi32(dir, _mm_and_si128(_mm_cmpeq_epi32(to, right), speed));
+            dir = _mm_sub_epi32(dir, _mm_and_si128(_mm_cmpeq_epi32(to, left), speed));
+            dir = _mm_add_epi32(dir, _mm_and_si128(_mm_cmplt_epi32(dir, zero), full));
+            dir = _mm_sub_epi32(dir, _mm_andnot_si128(_mm_cmplt_epi32(dir, full), full));
+            _mm_store_si128((__m128i *) &direction[i], dir);
+        }
+#else
+        for (uint32_t i = 0; i < batched(); ++i) {
+            int32_t dir = direction[i];
+            dir += turn[i] == 1 ? (int32_t) turning_speed : 0;
+            dir -= turn[i] == 2 ? (int32_t) turning_speed : 0;
+            dir += dir < 0 ? 360 : 0;
+            dir -= dir >= 360 ? 360 : 0;
+            direction[i] = dir;
+        }
+#endif
+    }
+
+    /* Moves every worm one step in its direction and marks in moved which of them entered
+     * a pixel different from the one they were in. */
+    void advance_all() {
+        for (uint32_t i = 0; i < batched(); ++i) {
+            const Step &step = STEPS[direction[i]];
+            step_x[i] = step.dx;
+            step_y[i] = step.dy;
+        }
+#if defined(__SSE2__)
+        // Positions stay within int32 range, so truncating conversion gives the same pixel as
+        // a cast to int64_t.
+        for (uint32_t i = 0; i < batched(); i += 2) {
+            __m128d old_x = _mm_load_pd(&x[i]), old_y = _mm_load_pd(&y[i]);
+            __m128d new_x = _mm_add_pd(old_x, _mm_load_pd(&step_x[i]));
+            __m128d new_y = _mm_add_pd(old_y, _mm_load_pd(&step_y[i]));
+            _mm_store_pd(&x[i], new_x);
+            _mm_store_pd(&y[i], new_y);
+            __m128i same = _mm_and_si128(
+                    _mm_cmpeq_epi32(_mm_cvttpd_epi32(old_x), _mm_cvttpd_epi32(new_x)),
+                    _mm_cmpeq_epi32(_mm_cvttpd_epi32(old_y), _mm_cvttpd_epi32(new_y)));
+            _mm_storel_epi64((__m128i *) &moved[i], _mm_xor_si128(same, _mm_set1_epi32(-1)));
+        }
+#else
+        for (uint32_t i = 0; i < batched(); ++i) {
+            auto old_x = (int64_t) x[i], old_y = (int64_t) y[i];
+            x[i] += step_x[i];
+            y[i] += step_y[i];
+            moved[i] = old_x != (int64_t) x[i] || old_y != (int64_t) y[i];
+        }
+#endif
+    }
+};
+
+#endif //SCREEN_WORMS_WORMS_H
@@ -0,0 +1,136 @@
+#include <unistd.h>
+#include <sys/resource.h>
+#include <new>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "../utils/util_func.h"
+#include "scripted_game.h"
+
+#define MIN_PLAYERS 2
+#define MIN_ROUNDS 1
+#define MAX_ROUNDS 1000000000
+
+using namespace std;
+
+static uint64_t allocations = 0;
+
+void *operator new(size_t size) {
+    ++allocations;
+    void *ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+/* Runs scripted game as fast as possible and measures it. Players change direction at
+ * pseudo-random rounds. Time per round includes passing the players' messages to the game
+ * manager, as the server does every round. */
+class Bench {
+private:
+    GameManager settings;
+
+public:
+    int64_t seed = 1;
+    uint32_t players_count = 2;
+    uint32_t rounds = 100000;
+
+    /* Returns true in case of success or false otherwise. */
+    bool parse_args(int argc, char **argv) {
+        int opt;
+
+        while ((opt = getopt(argc, argv, "s:n:w:h:t:r:")) != -1) {
+            try {
+                switch (opt) {
+                    case 's':
+                        this->set_seed(string_to_int(optarg));
+                        break;
+                    case 'n':
+                        this->set_players_count(string_to_int(optarg));
+                        break;
+                    case 'w':
+                        settings.set_width(string_to_int(optarg));
+                        break;
+                    case 'h':
+                        settings.set_height(string_to_int(optarg));
+                        break;
+                    case 't':
+                        settings.set_turning_speed(string_to_int(optarg));
+                        break;
+                    case 'r':
+                        this->set_rounds(string_to_int(optarg));
+                        break;
+                    default:
+                        return false;
+                }
+            }
+            catch (LimitException &e) {
+                exit_error(e.what());
+            }
+            catch (exception &e) {
+                return false;
+            }
+        }
+        return (optind >= argc);
+    }
+
+    void set_seed(int64_t _seed) {
+        check_limits(_seed, MIN_SEED, MAX_SEED, "Seed");
+        seed = _seed;
+    }
+
+    void set_players_count(int64_t count) {
+        check_limits(count, MIN_PLAYERS, PLAYERS_LIMIT, "Players");
+        players_count = count;
+    }
+
+    void set_rounds(int64_t _rounds) {
+        check_limits(_rounds, MIN_ROUNDS, MAX_ROUNDS, "Rounds");
+        rounds = _rounds;
+    }
+
+    /* Runs all rounds and prints measurements. */
+    void run() {
+        ScriptedGame game(settings, players_count, TRACE_RANDOM, seed);
+        uint64_t allocations_before = allocations;
+        auto start = chrono::steady_clock::now();
+
+        while (game.rounds_run < rounds) {
+            game.step();
+        }
+
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        uint64_t allocated = allocations - allocations_before;
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+
+        printf("games: %lu\n", game.games);
+        printf("rounds: %lu\n", game.rounds_run);
+        printf("events: %lu\n", game.events);
+        printf("seconds: %.6f\n", elapsed.count());
+        printf("rounds/sec: %.0f\n", game.rounds_run / elapsed.count());
+        printf("events/sec: %.0f\n", game.events / elapsed.count());
+        printf("ns/round: %.1f\n", elapsed.count() * 1e9 / game.rounds_run);
+        printf("peak RSS kB: %ld\n", usage.ru_maxrss);
+        printf("allocations/round: %.3f\n", (double) allocated / game.rounds_run);
+    }
+};
+
+int main(int argc, char **argv) {
+    Bench bench;
+    if (!bench.parse_args(argc, argv)) {
+        exit_error("Usage: " + string(argv[0]) + " -s seed -n players -w width -h height "
+                   + "-t turning_speed -r rounds");
+    }
+    bench.run();
+    return 0;
+}
@@ -0,0 +1,318 @@
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include "../utils/util_func.h"
+#include "../utils/wire.h"
+#include "scripted_game.h"
+
+#define GOLDEN_MAGIC "SWG1"
+#define MIN_GAMES_PER_CASE 1
+#define MAX_GAMES_PER_CASE 100
+#define MIN_ROUNDS_PER_CASE 1
+#define MAX_ROUNDS_PER_CASE 1000000
+
+using namespace std;
+
+static const int64_t SEEDS[] = {1, 7, 12345, 4294967295};
+static const pair<uint32_t, uint32_t> BOARDS[] = {{16, 16}, {64, 48}, {640, 480}, {2560, 1440}};
+static const uint32_t TURNING_SPEEDS[] = {1, 6, 90};
+static const uint32_t PLAYER_COUNTS[] = {2, 5, PLAYERS_LIMIT};
+static const Trace TRACES[] = {TRACE_STRAIGHT, TRACE_ZIGZAG, TRACE_RANDOM};
+
+/* Single configuration of the matrix. */
+class GoldenCase {
+public:
+    int64_t seed;
+    uint32_t width;
+    uint32_t height;
+    uint32_t turning_speed;
+    uint32_t players;
+    Trace trace;
+
+    string describe() const {
+        return "seed " + to_string(seed) + ", board " + to_string(width) + "x"
+               + to_string(height) + ", turning speed " + to_string(turning_speed) + ", "
+               + to_string(players) + " players, " + TRACE_NAMES[trace] + " trace";
+    }
+};
+
+/* Events of a single game as read from a stream. */
+class GoldenGame {
+public:
+    uint32_t game_id;
+    vector<string_view> events;
+};
+
+/* Records event streams of scripted games for a matrix of seeds, board sizes, turning speeds,
+ * player counts and input traces, or compares them with a stream recorded before, possibly by
+ * another build. Stream holds every game of every case with its game id and events exactly
+ * as they are sent to clients:
+ *
+ *   "SWG1", games per case, rounds per case, number of cases (4 bytes each),
+ *   for every case: number of games,
+ *   for every game: game id, number of events, events in wire format.
+ *
+ * Case ends after given number of games or rounds, whichever comes first, the last game may
+ * then be unfinished. */
+class Golden {
+private:
+    vector<GoldenCase> cases;
+
+    void build_matrix() {
+        for (int64_t seed: SEEDS) {
+            for (auto board: BOARDS) {
+                for (uint32_t turning_speed: TURNING_SPEEDS) {
+                    for (uint32_t players: PLAYER_COUNTS) {
+                        for (Trace trace: TRACES) {
+                            cases.push_back(GoldenCase{seed, board.first, board.second,
+                                                       turning_speed, players, trace});
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    static void append32(string &stream, uint32_t num) {
+        char bytes[sizeof(uint32_t)];
+        serialize32(num, bytes);
+        stream.append(bytes, sizeof(uint32_t));
+    }
+
+    static void append_game(string &stream, const GameState &state) {
+        append32(stream, state.game_id);
+        append32(stream, state.events.size());
+        for (size_t event = 0; event < state.events.size(); ++event) {
+            stream.append(state.events.data(event), state.events.length(event));
+        }
+    }
+
+    /* Plays given case and appends its games to stream. */
+    void record_case(string &stream, const GoldenCase &golden_case) {
+        GameManager settings;
+        settings.set_width(golden_case.width);
+        settings.set_height(golden_case.height);
+        settings.set_turning_speed(golden_case.turning_speed);
+        ScriptedGame game(settings, golden_case.players, golden_case.trace, golden_case.seed);
+
+        string games;
+        uint64_t recorded = 0;
+        while (recorded < games_per_case && game.rounds_run < rounds_per_case) {
+            game.step();
+            if (!game.game_manager.game_state.started && game.games > recorded) {
+                append_game(games, game.game_manager.game_state);
+                ++recorded;
+            }
+        }
+        if (game.games > recorded && recorded < games_per_case) { // Unfinished game
+            append_game(games, game.game_manager.game_state);
+            ++recorded;
+        }
+        append32(stream, recorded);
+        stream.append(games);
+    }
+
+    /* Reads games of one case from stream. */
+    static vector<GoldenGame> read_case(ByteReader &reader) {
+        vector<GoldenGame> games(reader.read32());
+        for (auto &game: games) {
+            game.game_id = reader.read32();
+            game.events.resize(reader.read32());
+            for (auto &event: game.events) {
+                const char *start = reader.current();
+                size_t len = reader.read32();
+                reader.read_bytes(len + sizeof(uint32_t));
+                event = string_view(start, len + 2 * sizeof(uint32_t));
+            }
+        }
+        return games;
+    }
+
+    /* Returns readable form of encoded event. */
+    static string describe_event(string_view bytes) {
+        EventView event;
+        try {
+            ByteReader reader(bytes);
+            event = EventView::read(reader);
+        }
+        catch (exception &e) {
+            return "undecodable event";
+        }
+
+        string ret = "#" + to_string(event.event_no) + " ";
+        if (event.event_type == NEW_GAME) {
+            ret += "NEW_GAME " + to_string(event.maxx) + "x" + to_string(event.maxy);
+            size_t pos = 0;
+            string_view name;
+            while (event.next_name(pos, name)) {
+                ret += " " + string(name);
+            }
+        }
+        else if (event.event_type == PIXEL) {
+            ret += "PIXEL player " + to_string(event.player_number) + " at ("
+                   + to_string(event.x) + ", " + to_string(event.y) + ")";
+        }
+        else if (event.event_type == PLAYER_ELIMINATED) {
+            ret += "PLAYER_ELIMINATED player " + to_string(event.player_number);
+        }
+        else if (event.event_type == GAME_OVER) {
+            ret += "GAME_OVER";
+        }
+        else {
+            ret += "event of type " + to_string(event.event_type);
+        }
+        return ret + " (crc32 " + to_string(event.crc32) + ")";
+    }
+
+    /* Returns description of the first difference between expected and actual games of a
+     * case or empty string if there is none. */
+    static string first_divergence(const vector<GoldenGame> &expected,
+                                   const vector<GoldenGame> &actual) {
+        for (size_t game = 0; game < min(expected.size(), actual.size()); ++game) {
+            const GoldenGame &want = expected[game], &got = actual[game];
+            string where = "game " + to_string(game) + ": ";
+            if (want.game_id != got.game_id) {
+                return where + "expected game id " + to_string(want.game_id) + ", got "
+                       + to_string(got.game_id);
+            }
+            for (size_t event = 0; event < max(want.events.size(), got.events.size()); ++event) {
+                string_view want_event = event < want.events.size() ? want.events[event] : "";
+                string_view got_event = event < got.events.size() ? got.events[event] : "";
+                if (want_event != got_event) {
+                    return where + "event " + to_string(event) + ": expected "
+                           + (want_event.empty() ? "no event" : describe_event(want_event))
+                           + ", got "
+                           + (got_event.empty() ? "no event" : describe_event(got_event));
+                }
+            }
+        }
+        if (expected.size() != actual.size()) {
+            return "expected " + to_string(expected.size()) + " games, got "
+                   + to_string(actual.size());
+        }
+        return string();
+    }
+
+public:
+    string record_path;
+    string compare_path;
+    uint32_t games_per_case = 3;
+    uint32_t rounds_per_case = 1000;
+
+    /* Returns true in case of success or false otherwise. */
+    bool parse_args(int argc, char **argv) {
+        int opt;
+
+        while ((opt = getopt(argc, argv, "o:c:g:n:")) != -1) {
+            try {
+                switch (opt) {
+                    case 'o':
+                        record_path = optarg;
+                        break;
+                    case 'c':
+                        compare_path = optarg;
+                        break;
+                    case 'g':
+                        this->set_games_per_case(string_to_int(optarg));
+                        break;
+                    case 'n':
+                        this->set_rounds_per_case(string_to_int(optarg));
+                        break;
+                    default:
+                        return false;
+                }
+            }
+            catch (LimitException &e) {
+                exit_error(e.what());
+            }
+            catch (exception &e) {
+                return false;
+            }
+        }
+        return optind >= argc && record_path.empty() != compare_path.empty();
+    }
+
+    void set_games_per_case(int64_t games) {
+        check_limits(games, MIN_GAMES_PER_CASE, MAX_GAMES_PER_CASE, "Games per case");
+        games_per_case = games;
+    }
+
+    void set_rounds_per_case(int64_t rounds) {
+        check_limits(rounds, MIN_ROUNDS_PER_CASE, MAX_ROUNDS_PER_CASE, "Rounds per case");
+        rounds_per_case = rounds;
+    }
+
+    /* Writes stream of all cases to record_path. */
+    void record() {
+        build_matrix();
+        string stream = GOLDEN_MAGIC;
+        append32(stream, games_per_case);
+        append32(stream, rounds_per_case);
+        append32(stream, cases.size());
+        for (auto &golden_case: cases) {
+            record_case(stream, golden_case);
+        }
+
+        ofstream file(record_path, ios::binary);
+        file.write(stream.data(), stream.size());
+        if (!file) {
+            exit_error("Cannot write " + record_path);
+        }
+        printf("%zu cases recorded, %zu bytes\n", cases.size(), stream.size());
+    }
+
+    /* Plays all cases again with limits read from compare_path and compares their games
+     * with the recorded ones. Exits with failure at the first difference. */
+    void compare() {
+        ifstream file(compare_path, ios::binary);
+        stringstream contents;
+        contents << file.rdbuf();
+        string recorded = contents.str();
+        if (!file || recorded.compare(0, strlen(GOLDEN_MAGIC), GOLDEN_MAGIC) != 0) {
+            exit_error("Cannot read golden stream from " + compare_path);
+        }
+
+        build_matrix();
+        try {
+            ByteReader reader(recorded.data() + strlen(GOLDEN_MAGIC),
+                              recorded.size() - strlen(GOLDEN_MAGIC));
+            games_per_case = reader.read32();
+            rounds_per_case = reader.read32();
+            if (reader.read32() != cases.size()) {
+                exit_error("Golden stream was recorded for a different matrix");
+            }
+
+            for (size_t i = 0; i < cases.size(); ++i) {
+                string stream;
+                record_case(stream, cases[i]);
+                ByteReader actual_reader(stream);
+                string divergence = first_divergence(read_case(reader),
+                                                     read_case(actual_reader));
+                if (!divergence.empty()) {
+                    exit_error("Case " + to_string(i) + " (" + cases[i].describe() + "), "
+                               + divergence);
+                }
+            }
+        }
+        catch (TruncatedMessageException &e) {
+            exit_error("Golden stream in " + compare_path + " is truncated");
+        }
+        printf("%zu cases identical\n", cases.size());
+    }
+};
+
+int main(int argc, char **argv) {
+    Golden golden;
+    if (!golden.parse_args(argc, argv)) {
+        exit_error("Usage: " + string(argv[0]) + " -o golden_file [-g games_per_case] "
+                   + "[-n rounds_per_case] | -c golden_file");
+    }
+    if (!golden.record_path.empty()) {
+        golden.record();
+    }
+    else {
+        golden.compare();
+    }
+    return 0;
+}
@@ -0,0 +1,309 @@
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "../utils/util_func.h"
+#include "../utils/crc32.h"
+#include "../utils/rng.h"
+#include "../common/messages.h"
+
+#define MIN_CASE_MILLIS 10
+#define MAX_CASE_MILLIS 60000
+#define CALIBRATION_MILLIS 10 // Minimal duration of batch used to choose number of iterations
+#define REPETITIONS 5 // Measured batches of every case, minimum and median are reported
+#define LOG_PIXELS 1000 // PIXEL events of the log messages are built from
+#define SERIALIZED_NUMBERS 64 // Numbers serialized by one operation of serialize cases
+#define NAME_LENGTH 20 // Longest allowed player name
+
+using namespace std;
+
+/* Keeps compiler from optimizing away computation of value. */
+template<typename T>
+inline void keep(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/* Measurements of a single case. */
+class MicroResult {
+public:
+    string name;
+    uint64_t iterations;
+    double ns_per_op; // Best of repetitions
+    double ns_per_op_median;
+    size_t items_per_op; // Events, numbers or datagrams processed by one operation
+    size_t bytes_per_op;
+};
+
+/* Built-in microbenchmark harness for the protocol hot paths: checksums, number and event
+ * serialization, event parsing and packing events into datagrams. Every case runs its
+ * operation in batches long enough for timer resolution not to matter, results are printed
+ * as JSON. Data resembles real traffic: datagrams packed full of PIXEL events and NEW_GAME
+ * with PLAYERS_LIMIT names of the longest allowed length, which fills a datagram exactly. */
+class MicroBench {
+private:
+    vector<MicroResult> results;
+    EventLog pixels;
+    EventLog new_game;
+    string pixel_datagram;
+    string new_game_datagram;
+
+    template<typename Op>
+    static double time_batch(Op &op, uint64_t iterations) {
+        auto start = chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            op();
+        }
+        chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    /* Measures operation unless filtered out. Number of iterations is doubled until a batch
+     * takes CALIBRATION_MILLIS, then scaled so that all repetitions take case_millis. */
+    template<typename Op>
+    void run_case(const string &name, size_t items_per_op, size_t bytes_per_op, Op op) {
+        if (name.find(filter) == string::npos) {
+            return;
+        }
+
+        uint64_t iterations = 1;
+        double nanos;
+        while ((nanos = time_batch(op, iterations)) < CALIBRATION_MILLIS * 1e6) {
+            iterations *= 2;
+        }
+        iterations = max((uint64_t) 1,
+                         (uint64_t) (iterations * (case_millis * 1e6 / REPETITIONS) / nanos));
+
+        vector<double> ns_per_op;
+        for (int repetition = 0; repetition < REPETITIONS; ++repetition) {
+            ns_per_op.push_back(time_batch(op, iterations) / iterations);
+        }
+        sort(ns_per_op.begin(), ns_per_op.end());
+        results.push_back(MicroResult{name, iterations * REPETITIONS, ns_per_op.front(),
+                                      ns_per_op[REPETITIONS / 2], items_per_op, bytes_per_op});
+    }
+
+    /* Fills logs and datagrams cases work on. */
+    void prepare() {
+        Rng rng(1);
+        for (uint32_t i = 0; i < LOG_PIXELS; ++i) {
+            pixels.append_pixel(i % PLAYERS_LIMIT, rng.get_random() % 640,
+                                rng.get_random() % 480);
+        }
+        vector<string> names;
+        for (uint32_t i = 0; i < PLAYERS_LIMIT; ++i) {
+            string name = "player" + to_string(i);
+            names.push_back(name + string(NAME_LENGTH - name.size(), '_'));
+        }
+        new_game.append_new_game(640, 480, names);
+
+        char buffer[DATAGRAM_SIZE];
+        size_t next_event = 0;
+        ServerMsg pixels_msg(1, pixels, 0, pixels.size());
+        pixel_datagram.assign(buffer, pixels_msg.write_datagram(next_event, buffer));
+        next_event = 0;
+        ServerMsg new_game_msg(1, new_game, 0, new_game.size());
+        new_game_datagram.assign(buffer, new_game_msg.write_datagram(next_event, buffer));
+    }
+
+    static size_t events_in(const string &datagram) {
+        return ServerMsg(datagram.data(), datagram.size()).events.size();
+    }
+
+    void crc32_cases() {
+        for (size_t size: {(size_t) 18, (size_t) DATAGRAM_SIZE, (size_t) 65536}) {
+            string data(size, 'x');
+            run_case("crc32/" + to_string(size), 1, size, [&]() {
+                keep(crc32(data.data(), data.size()));
+            });
+        }
+        string datagram(DATAGRAM_SIZE, 'x');
+        for (int kernel = CRC32_REFERENCE; kernel <= CRC32_PCLMUL; ++kernel) {
+            if (!crc32_kernel_supported((Crc32Kernel) kernel)) {
+                continue;
+            }
+            run_case("crc32_update/" + string(crc32_kernel_name((Crc32Kernel) kernel)) + "/"
+                     + to_string(DATAGRAM_SIZE), 1, DATAGRAM_SIZE, [&]() {
+                keep(crc32_update((Crc32Kernel) kernel, ~0U, datagram.data(), datagram.size()));
+            });
+        }
+    }
+
+    void serialize_cases() {
+        char buffer[SERIALIZED_NUMBERS * sizeof(uint64_t)];
+        run_case("serialize32", SERIALIZED_NUMBERS, SERIALIZED_NUMBERS * sizeof(uint32_t),
+                 [&]() {
+            for (uint32_t i = 0; i < SERIALIZED_NUMBERS; ++i) {
+                serialize32(i * 2654435761U, buffer + i * sizeof(uint32_t));
+            }
+            keep(&buffer[0]);
+        });
+        run_case("serialize64", SERIALIZED_NUMBERS, SERIALIZED_NUMBERS * sizeof(uint64_t),
+                 [&]() {
+            for (uint64_t i = 0; i < SERIALIZED_NUMBERS; ++i) {
+                serialize64(i * 11400714819323198485ULL, buffer + i * sizeof(uint64_t));
+            }
+            keep(&buffer[0]);
+        });
+    }
+
+    void event_serialize_cases() {
+        char buffer[DATAGRAM_SIZE];
+        Event pixel(PIXEL, make_shared<PixelData>(3, 320, 240));
+        run_case("Event::serialize/pixel", 1, pixel.size(), [&]() {
+            ByteWriter writer(buffer, DATAGRAM_SIZE);
+            pixel.serialize(writer);
+            keep(&buffer[0]);
+        });
+
+        ByteReader reader(new_game.data(0), new_game.length(0));
+        Event new_game_event(EventView::read(reader));
+        run_case("Event::serialize/new_game_25", 1, new_game_event.size(), [&]() {
+            ByteWriter writer(buffer, DATAGRAM_SIZE);
+            new_game_event.serialize(writer);
+            keep(&buffer[0]);
+        });
+
+        EventLog log;
+        run_case("EventLog::append_pixel", LOG_PIXELS, pixels.length(0) * LOG_PIXELS, [&]() {
+            log.clear();
+            for (uint32_t i = 0; i < LOG_PIXELS; ++i) {
+                log.append_pixel(i % PLAYERS_LIMIT, i, i);
+            }
+            keep(log.data(0));
+        });
+    }
+
+    void parse_cases() {
+        for (auto datagram: {make_pair("pixel_datagram", &pixel_datagram),
+                             make_pair("new_game_25", &new_game_datagram)}) {
+            const string &bytes = *datagram.second;
+            size_t events = events_in(bytes);
+            run_case(string("EventView::read/") + datagram.first, events, bytes.size(), [&]() {
+                ByteReader reader(bytes.data() + sizeof(uint32_t),
+                                  bytes.size() - sizeof(uint32_t));
+                while (!reader.empty()) {
+                    keep(EventView::read(reader).crc32);
+                }
+            });
+            run_case(string("Event(EventView)/") + datagram.first, events, bytes.size(),
+                     [&]() {
+                ByteReader reader(bytes.data() + sizeof(uint32_t),
+                                  bytes.size() - sizeof(uint32_t));
+                while (!reader.empty()) {
+                    keep(Event(EventView::read(reader)).crc32);
+                }
+            });
+            run_case(string("ServerMsgReader/") + datagram.first, events, bytes.size(), [&]() {
+                ServerMsgReader reader(bytes.data(), bytes.size());
+                EventView event;
+                while (reader.next(event)) {
+                    keep(event.crc32);
+                }
+            });
+            run_case(string("ServerMsg(const char*, size_t)/") + datagram.first, events,
+                     bytes.size(), [&]() {
+                keep(ServerMsg(bytes.data(), bytes.size()).events.size());
+            });
+        }
+    }
+
+    void datagram_cases() {
+        char buffer[DATAGRAM_SIZE];
+        ServerMsg full(1, pixels, 0, events_in(pixel_datagram));
+        run_case("ServerMsg::write_datagram/pixel_datagram", full.last_event,
+                 pixel_datagram.size(), [&]() {
+            size_t next_event = full.first_event;
+            keep(full.write_datagram(next_event, buffer));
+            keep(&buffer[0]);
+        });
+
+        ServerMsg all(1, pixels, 0, pixels.size());
+        size_t datagrams = all.get_datagrams().size();
+        size_t bytes = 0;
+        for (auto &datagram: all.get_datagrams()) {
+            bytes += datagram.size();
+        }
+        run_case("ServerMsg::get_datagrams/" + to_string(LOG_PIXELS) + "_pixels", datagrams,
+                 bytes, [&]() {
+            keep(all.get_datagrams().size());
+        });
+
+        ServerMsg new_game_msg(1, new_game, 0, new_game.size());
+        run_case("ServerMsg::get_datagrams/new_game_25", 1, new_game_datagram.size(), [&]() {
+            keep(new_game_msg.get_datagrams().size());
+        });
+    }
+
+    void print_json() {
+        printf("{\n  \"context\": {\"crc32_kernel\": \"%s\", \"datagram_size\": %d, "
+               "\"repetitions\": %d},\n  \"benchmarks\": [",
+               crc32_kernel_name(crc32_best_kernel()), DATAGRAM_SIZE, REPETITIONS);
+        for (size_t i = 0; i < results.size(); ++i) {
+            const MicroResult &result = results[i];
+            printf("%s\n    {\"name\": \"%s\", \"iterations\": %lu, \"ns_per_op\": %.3f, "
+                   "\"ns_per_op_median\": %.3f, \"items_per_op\": %zu, \"bytes_per_op\": %zu, "
+                   "\"mb_per_s\": %.1f}", i == 0 ? "" : ",", result.name.c_str(),
+                   result.iterations, result.ns_per_op, result.ns_per_op_median,
+                   result.items_per_op, result.bytes_per_op,
+                   result.bytes_per_op * 1e3 / result.ns_per_op);
+        }
+        printf("\n  ]\n}\n");
+    }
+
+public:
+    uint32_t case_millis = 500;
+    string filter; // Only cases with names containing it are run
+
+    /* Returns true in case of success or false otherwise. */
+    bool parse_args(int argc, char **argv) {
+        int opt;
+
+        while ((opt = getopt(argc, argv, "m:f:")) != -1) {
+            try {
+                switch (opt) {
+                    case 'm':
+                        this->set_case_millis(string_to_int(optarg));
+                        break;
+                    case 'f':
+                        filter = optarg;
+                        break;
+                    default:
+                        return false;
+                }
+            }
+            catch (LimitException &e) {
+                exit_error(e.what());
+            }
+            catch (exception &e) {
+                return false;
+            }
+        }
+        return (optind >= argc);
+    }
+
+    void set_case_millis(int64_t millis) {
+        check_limits(millis, MIN_CASE_MILLIS, MAX_CASE_MILLIS, "Case time");
+        case_millis = millis;
+    }
+
+    void run() {
+        prepare();
+        crc32_cases();
+        serialize_cases();
+        event_serialize_cases();
+        parse_cases();
+        datagram_cases();
+        print_json();
+    }
+};
+
+int main(int argc, char **argv) {
+    MicroBench bench;
+    if (!bench.parse_args(argc, argv)) {
+        exit_error("Usage: " + string(argv[0]) + " -m case_millis -f name_filter");
+    }
+    bench.run();
+    return 0;
+}
@@ -0,0 +1,707 @@
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <cstdio>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include "../utils/util_func.h"
+#include "../utils/timer.h"
+#include "../common/messages.h"
+#include "scripted_player.h"
+
+#define MIN_SESSIONS 1
+#define MAX_SESSIONS 100000
+#define MIN_PERCENT 0
+#define MAX_PERCENT 100
+#define MIN_SEND_INTERVAL 1
+#define MAX_SEND_INTERVAL 10000
+#define MIN_DURATION 1
+#define MAX_DURATION 86400
+#define MAX_EPOLL_EVENTS 256
+#define RESERVED_FDS 16 // Standard streams, epoll and some spare descriptors
+#define REPORTED_VIOLATIONS 10 // Violations described one by one, the rest is only counted
+
+using namespace std;
+
+using SteadyTime = chrono::steady_clock::time_point;
+
+/* Ways in which datagrams from the server may break the protocol. */
+enum Violation {
+    BAD_CRC,
+    TRUNCATED,
+    UNKNOWN_TYPE,
+    BAD_ORDER,
+    INCONSISTENT,
+    BAD_VALUE,
+    BAD_BOARD,
+    VIOLATION_KINDS
+};
+
+static const char *VIOLATION_NAMES[] = {"incorrect crc32", "truncated events",
+                                        "unknown event types", "events out of order",
+                                        "inconsistent events", "incorrect values",
+                                        "incomplete boards"};
+
+/* Events of a game seen by any session. All sessions of the game must get the same ones. */
+class GameRecord {
+public:
+    vector<uint32_t> crcs;
+    vector<bool> known;
+    vector<int64_t> pixels; // Row-major position * 256 + owner of PIXEL events, -1 of others
+    int64_t game_over = -1; // Number of GAME_OVER event, -1 if not seen yet
+
+    /* Remembers crc of the event. Returns false if another crc was seen for its number. */
+    bool check(uint32_t event_no, uint32_t crc) {
+        if (event_no >= crcs.size()) {
+            crcs.resize(event_no + 1);
+            known.resize(event_no + 1);
+            pixels.resize(event_no + 1, -1);
+        }
+        if (known[event_no]) {
+            return crcs[event_no] == crc;
+        }
+        known[event_no] = true;
+        crcs[event_no] = crc;
+        return true;
+    }
+
+    /* Number of events of the game some session knows about. */
+    uint32_t size() const {
+        return crcs.size();
+    }
+};
+
+/* Single simulated client with its own socket, and so its own source port. Like the real
+ * client it accepts events only in order and asks for the first missing one in every
+ * message, so everything behind a lost datagram comes again. */
+class SwarmSession {
+public:
+    int sock = -1;
+    uint64_t session_id;
+    bool observer;
+    bool late; // Joins in the middle of the run, its board is checked
+    ScriptedPlayer player;
+    SteadyTime next_send;
+    bool joined = false; // Sent its first message
+
+    uint32_t game_id = 0;
+    bool in_game = false; // NEW_GAME of game_id was received
+    bool started = false; // GAME_OVER of game_id was not received yet
+    uint32_t next_expected = 0;
+    int64_t highest_seen = -1; // Greatest event number of game_id received
+    uint64_t round = 0; // Messages sent since NEW_GAME
+    uint32_t maxx = 0;
+    uint32_t maxy = 0;
+    uint32_t players = 0;
+    unordered_map<uint32_t, uint8_t> board; // Owners of eaten pixels, late sessions only
+    bool board_checked = false;
+    SnapshotParts snapshot_parts;
+
+    bool waiting = false; // Asked for events it knows it misses, no answer yet
+    uint32_t requested = 0;
+    SteadyTime request_time;
+
+    uint64_t datagrams = 0;
+    uint64_t events = 0; // Accepted in order
+    uint64_t snapshot_events = 0;
+    uint64_t retransmitted_events = 0; // Numbered below the highest one received before
+    uint64_t retransmitted_bytes = 0;
+    uint64_t dropped_events = 0; // Out of order or of an unknown game
+    uint64_t lag_sum = 0;
+    uint64_t lag_samples = 0;
+    uint32_t max_lag = 0;
+
+    SwarmSession(uint64_t _session_id, bool _observer, bool _late, ScriptedPlayer _player) :
+            session_id(_session_id),
+            observer(_observer),
+            late(_late),
+            player(std::move(_player)) {}
+
+    /* Forgets the previous game. */
+    void join_game(uint32_t _game_id) {
+        game_id = _game_id;
+        in_game = false;
+        started = false;
+        next_expected = 0;
+        highest_seen = -1;
+        round = 0;
+        waiting = false;
+        board.clear();
+        board_checked = false;
+        snapshot_parts.reset();
+    }
+};
+
+/* Load generator: thousands of players and observers in one process and one event loop.
+ * Every session sends its message each send interval, players turn according to their
+ * trace. Datagrams from the server are checked for correct crc32, order and consistency
+ * between sessions. Lost packets are simulated in both directions.
+ *
+ * Late observers join in the middle of the run and so catch up with a game in progress,
+ * through a snapshot if the server sends them one. Each of them keeps the board it learnt,
+ * which must hold exactly the pixels of the events it accepted, as other sessions got them
+ * one by one. Boards are checked at GAME_OVER and at the end of the run. */
+class Swarm {
+private:
+    vector<SwarmSession> sessions;
+    // Sessions by time of their next message, earliest on top.
+    priority_queue<pair<SteadyTime, uint32_t>, vector<pair<SteadyTime, uint32_t>>,
+                   greater<>> send_order;
+    unordered_map<uint32_t, GameRecord> games;
+    int epoll_fd = -1;
+    Rng loss_rng = Rng(1);
+    uint64_t violations[VIOLATION_KINDS] = {};
+    uint64_t violations_total = 0;
+
+    uint64_t messages_sent = 0;
+    uint64_t messages_lost = 0;
+    uint64_t send_errors = 0;
+    uint64_t datagrams_lost = 0;
+    uint64_t received_bytes = 0;
+    uint64_t boards_checked = 0;
+    uint64_t boards_unverified = 0; // No session got all events the board should describe
+    vector<double> latencies; // Milliseconds from asking for missing events to getting them
+
+    bool lost() {
+        return loss_percent > 0 && loss_rng.get_random() % 100 < loss_percent;
+    }
+
+    void violation(Violation kind, const SwarmSession &session, uint32_t game_id,
+                   int64_t event_no) {
+        ++violations[kind];
+        if (violations_total++ < REPORTED_VIOLATIONS) {
+            fprintf(stderr, "session %u, game %u, event %ld: %s\n",
+                    (uint32_t) (&session - sessions.data()), game_id, event_no,
+                    VIOLATION_NAMES[kind]);
+        }
+    }
+
+    void raise_open_files_limit() {
+        rlimit limit{};
+        rlim_t needed = sessions_count + late_observers + RESERVED_FDS;
+        getrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur < needed) {
+            limit.rlim_cur = min(limit.rlim_max, needed);
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+        if (limit.rlim_cur < needed) {
+            exit_error("Open files limit too low for " + to_string(needed - RESERVED_FDS)
+                       + " sessions");
+        }
+    }
+
+    /* Creates sessions, each with its own socket connected to the server. Observers are
+     * spread evenly among players, first messages evenly over one send interval. */
+    void create_sessions() {
+        sockaddr_storage server_addr{};
+        struct addrinfo host = resolve_host(game_server, SOCK_DGRAM, game_server_port,
+                                            server_addr);
+
+        epoll_fd = epoll_create1(0);
+        if (epoll_fd < 0) {
+            exit_error("Epoll error");
+        }
+
+        uint64_t first_session_id = Timer::get_session_id();
+        SteadyTime now = chrono::steady_clock::now();
+        sessions.reserve(sessions_count + late_observers);
+        for (uint32_t i = 0; i < sessions_count + late_observers; ++i) {
+            bool late = i >= sessions_count;
+            bool observer = late || (uint64_t) (i + 1) * observers_percent / 100
+                                    > (uint64_t) i * observers_percent / 100;
+            sessions.emplace_back(first_session_id + i, observer, late,
+                                  ScriptedPlayer(observer ? "" : "swarm" + to_string(i), i,
+                                                 trace, (int) ((seed + i + 1) % INT32_MAX)));
+            SwarmSession &session = sessions.back();
+            session.next_send = now + send_interval * i / sessions_count;
+            if (late) {
+                session.next_send = now + duration / 2
+                                    + send_interval * (i - sessions_count) / late_observers;
+            }
+
+            session.sock = socket(host.ai_family, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+            if (session.sock < 0) {
+                exit_error("Socket error");
+            }
+            if (connect(session.sock, host.ai_addr, host.ai_addrlen) < 0) {
+                exit_error("Connect");
+            }
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u32 = i;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, session.sock, &event) < 0) {
+                exit_error("Epoll ctl error");
+            }
+            send_order.emplace(session.next_send, i);
+        }
+    }
+
+    /* Samples lag of the session behind the most advanced session of its game and starts
+     * measuring reply latency if the session knows it misses some events. */
+    void sample(SwarmSession &session, SteadyTime now) {
+        if (!session.in_game) {
+            return;
+        }
+        uint32_t known = games[session.game_id].size();
+        uint32_t lag = known > session.next_expected ? known - session.next_expected : 0;
+        session.lag_sum += lag;
+        ++session.lag_samples;
+        session.max_lag = max(session.max_lag, lag);
+
+        if (!session.waiting && (int64_t) session.next_expected <= session.highest_seen) {
+            session.waiting = true;
+            session.requested = session.next_expected;
+            session.request_time = now;
+        }
+    }
+
+    /* Sends message of the session. Players join without being ready and get ready with
+     * their second message, so that the first game starts once all of them joined. */
+    void send_message(SwarmSession &session, SteadyTime now) {
+        sample(session, now);
+        uint8_t direction = 0;
+        if (!session.observer && session.joined) {
+            direction = session.player.next_direction(session.started, session.round);
+        }
+        session.joined = true;
+        ++session.round;
+        if (lost()) {
+            ++messages_lost;
+            return;
+        }
+
+        char buffer[MAX_CLIENT_MSG_LEN];
+        ByteWriter writer(buffer, MAX_CLIENT_MSG_LEN);
+        ClientToServerMsg(session.session_id, direction, session.next_expected,
+                          session.player.name).serialize(writer);
+        if (send(session.sock, buffer, writer.size(), 0) < 0) {
+            ++send_errors;
+        }
+        else {
+            ++messages_sent;
+        }
+    }
+
+    /* Ends latency measurement once the requested event arrived. */
+    void check_answered(SwarmSession &session, SteadyTime now) {
+        if (session.waiting && session.next_expected > session.requested) {
+            chrono::duration<double, milli> latency = now - session.request_time;
+            latencies.push_back(latency.count());
+            session.waiting = false;
+        }
+    }
+
+    /* Checks that snapshot part is numbered correctly and its pixels lie on the board and
+     * belong to players. Late session puts them on its board. Returns false if the part is
+     * incorrect. */
+    bool check_snapshot(SwarmSession &session, uint32_t game_id, const EventView &event) {
+        if (event.part >= event.parts) {
+            violation(BAD_VALUE, session, game_id, event.event_no);
+            return false;
+        }
+        uint64_t pixel = event.first_pixel, pixels = (uint64_t) session.maxx * session.maxy;
+        for (size_t run = 0; run < event.run_count(); ++run) {
+            uint8_t owner;
+            uint32_t skip, length;
+            event.run(run, owner, skip, length);
+            pixel += skip;
+            if (pixel + length > pixels || owner >= session.players) {
+                violation(BAD_VALUE, session, game_id, event.event_no);
+                return false;
+            }
+            for (uint32_t i = 0; session.late && i < length; ++i) {
+                session.board[pixel + i] = owner;
+            }
+            pixel += length;
+        }
+        return true;
+    }
+
+    /* Compares board of a late session with pixels of all events it accepted. Board cannot
+     * be verified if no session got some of the events. */
+    void check_board(SwarmSession &session) {
+        if (!session.late || !session.in_game || session.board_checked) {
+            return;
+        }
+        session.board_checked = true;
+        GameRecord &record = games[session.game_id];
+        unordered_map<uint32_t, uint8_t> expected;
+        for (uint32_t event_no = 0; event_no < session.next_expected; ++event_no) {
+            if (event_no >= record.size() || !record.known[event_no]) {
+                ++boards_unverified;
+                return;
+            }
+            if (record.pixels[event_no] >= 0) {
+                expected[record.pixels[event_no] / 256] = record.pixels[event_no] % 256;
+            }
+        }
+        ++boards_checked;
+        if (session.board != expected) {
+            violation(BAD_BOARD, session, session.game_id, session.next_expected);
+        }
+    }
+
+    /* Checks event values against its game. */
+    void check_values(SwarmSession &session, uint32_t game_id, const EventView &event) {
+        bool correct = true;
+        if (event.event_type == NEW_GAME) {
+            correct = session.players >= 2 && session.players <= PLAYERS_LIMIT;
+        }
+        else if (event.event_type == PIXEL) {
+            correct = event.x < session.maxx && event.y < session.maxy
+                      && event.player_number < session.players;
+        }
+        else if (event.event_type == PLAYER_ELIMINATED) {
+            correct = event.player_number < session.players;
+        }
+        if (!correct) {
+            violation(BAD_VALUE, session, game_id, event.event_no);
+        }
+    }
+
+    void handle_event(SwarmSession &session, uint32_t game_id, const EventView &event,
+                      size_t size, SteadyTime now) {
+        if (event.event_type == NEW_GAME && !(session.in_game && session.game_id == game_id)) {
+            session.join_game(game_id);
+            session.in_game = true;
+            session.started = true;
+            session.maxx = event.maxx;
+            session.maxy = event.maxy;
+            session.players = 0;
+            size_t pos = 0;
+            string_view name;
+            while (event.next_name(pos, name)) {
+                ++session.players;
+            }
+        }
+        if (game_id != session.game_id) { // New game, its NEW_GAME has to be asked for.
+            session.join_game(game_id);
+        }
+        if (!session.in_game) {
+            ++session.dropped_events;
+            return;
+        }
+
+        GameRecord &record = games[game_id];
+        if (event.event_type == SNAPSHOT) { // Describes all events up to its number.
+            ++session.snapshot_events;
+            if (event.event_no >= session.next_expected && check_snapshot(session, game_id, event)
+                && session.snapshot_parts.add(event) && session.snapshot_parts.complete()) {
+                session.next_expected = event.event_no + 1;
+                session.snapshot_parts.reset();
+            }
+            session.highest_seen = max(session.highest_seen, (int64_t) event.event_no);
+            check_answered(session, now);
+            return;
+        }
+        if (!record.check(event.event_no, event.crc32)) {
+            violation(INCONSISTENT, session, game_id, event.event_no);
+        }
+        if (event.event_type == PIXEL) {
+            record.pixels[event.event_no] = ((int64_t) event.y * session.maxx + event.x) * 256
+                                            + event.player_number;
+        }
+        if (record.game_over >= 0 && event.event_no > record.game_over) {
+            violation(BAD_ORDER, session, game_id, event.event_no);
+        }
+        if (event.event_type == GAME_OVER) {
+            record.game_over = event.event_no;
+        }
+
+        if ((int64_t) event.event_no <= session.highest_seen) {
+            ++session.retransmitted_events;
+            session.retransmitted_bytes += size;
+        }
+        session.highest_seen = max(session.highest_seen, (int64_t) event.event_no);
+        if (event.event_no != session.next_expected) {
+            if (event.event_no > session.next_expected) {
+                ++session.dropped_events;
+            }
+            return;
+        }
+
+        ++session.next_expected;
+        ++session.events;
+        check_values(session, game_id, event);
+        if (session.late && event.event_type == PIXEL) {
+            session.board[event.y * session.maxx + event.x] = event.player_number;
+        }
+        if (event.event_type == GAME_OVER) {
+            session.started = false;
+            check_board(session);
+        }
+        check_answered(session, now);
+    }
+
+    /* Decodes datagram event by event, checking their order within the datagram. */
+    void handle_datagram(SwarmSession &session, const char *buffer, size_t size,
+                         SteadyTime now) {
+        ByteReader reader(buffer, size);
+        if (size < sizeof(uint32_t)) {
+            violation(TRUNCATED, session, 0, -1);
+            return;
+        }
+        uint32_t game_id = reader.read32();
+        int64_t previous = -1;
+
+        while (!reader.empty()) {
+            EventView event;
+            try {
+                event = EventView::read(reader);
+            }
+            catch (UnknownEventTypeException &e) {
+                violation(UNKNOWN_TYPE, session, game_id, -1);
+                continue;
+            }
+            catch (IncorrectCrc32Exception &e) {
+                violation(BAD_CRC, session, game_id, -1);
+                return;
+            }
+            catch (TruncatedMessageException &e) {
+                violation(TRUNCATED, session, game_id, -1);
+                return;
+            }
+
+            // Snapshot chunks share number of the last event they describe.
+            bool ordered = event.event_type == SNAPSHOT ? event.event_no >= previous
+                                                        : event.event_no > previous;
+            if (!ordered || (event.event_type == NEW_GAME) != (event.event_no == 0)) {
+                violation(BAD_ORDER, session, game_id, event.event_no);
+            }
+            previous = event.event_no;
+            handle_event(session, game_id, event, event.len + 2 * sizeof(uint32_t), now);
+        }
+    }
+
+    /* Reads all waiting datagrams of the session. */
+    void receive(SwarmSession &session) {
+        char buffer[DATAGRAM_SIZE];
+        ssize_t size;
+        while ((size = recv(session.sock, buffer, DATAGRAM_SIZE, 0)) >= 0) {
+            if (lost()) {
+                ++datagrams_lost;
+                continue;
+            }
+            ++session.datagrams;
+            received_bytes += size;
+            handle_datagram(session, buffer, size, chrono::steady_clock::now());
+        }
+    }
+
+    template<typename T>
+    static T percentile(const vector<T> &sorted, double fraction) {
+        if (sorted.empty()) {
+            return T();
+        }
+        return sorted[min(sorted.size() - 1, (size_t) (fraction * sorted.size()))];
+    }
+
+    template<typename T>
+    static void print_distribution(const char *name, vector<T> values) {
+        sort(values.begin(), values.end());
+        printf("%s p50/p90/p99/p999/max: %.3f %.3f %.3f %.3f %.3f\n", name,
+               (double) percentile(values, 0.5), (double) percentile(values, 0.9),
+               (double) percentile(values, 0.99), (double) percentile(values, 0.999),
+               (double) (values.empty() ? T() : values.back()));
+    }
+
+    void report() {
+        uint64_t observers = 0, silent = 0, datagrams = 0, events = 0, retransmitted = 0;
+        uint64_t retransmitted_bytes = 0, dropped = 0, unanswered = 0, snapshot_events = 0;
+        vector<double> mean_lags;
+        vector<uint32_t> max_lags;
+        vector<uint64_t> retransmissions;
+        for (auto &session: sessions) {
+            observers += session.observer;
+            silent += session.datagrams == 0;
+            datagrams += session.datagrams;
+            events += session.events;
+            snapshot_events += session.snapshot_events;
+            retransmitted += session.retransmitted_events;
+            retransmitted_bytes += session.retransmitted_bytes;
+            dropped += session.dropped_events;
+            unanswered += session.waiting;
+            if (session.lag_samples > 0) {
+                mean_lags.push_back((double) session.lag_sum / session.lag_samples);
+                max_lags.push_back(session.max_lag);
+            }
+            retransmissions.push_back(session.retransmitted_events);
+        }
+
+        printf("sessions: %zu (%lu players, %lu observers)\n", sessions.size(),
+               sessions.size() - observers, observers);
+        printf("silent sessions: %lu\n", silent);
+        printf("games: %zu\n", games.size());
+        printf("messages sent: %lu (lost %lu, errors %lu)\n", messages_sent, messages_lost,
+               send_errors);
+        printf("datagrams received: %lu (lost %lu), bytes: %lu\n", datagrams, datagrams_lost,
+               received_bytes);
+        printf("events accepted: %lu, snapshot events: %lu\n", events, snapshot_events);
+        printf("events retransmitted: %lu, bytes: %lu\n", retransmitted, retransmitted_bytes);
+        printf("events dropped out of order: %lu\n", dropped);
+        print_distribution("retransmitted events per session", retransmissions);
+        print_distribution("mean event lag per session", mean_lags);
+        print_distribution("max event lag per session", max_lags);
+        printf("reply latency requests: %zu (unanswered %lu)\n", latencies.size(), unanswered);
+        printf("late boards checked: %lu (unverified %lu)\n", boards_checked,
+               boards_unverified);
+        print_distribution("reply latency ms", latencies);
+        for (int kind = 0; kind < VIOLATION_KINDS; ++kind) {
+            printf("%s: %lu\n", VIOLATION_NAMES[kind], violations[kind]);
+        }
+    }
+
+public:
+    string game_server;
+    string game_server_port = "2021";
+    uint32_t sessions_count = 100;
+    uint32_t observers_percent = 0;
+    uint32_t late_observers = 0;
+    uint32_t loss_percent = 0;
+    chrono::milliseconds send_interval = chrono::milliseconds(30);
+    chrono::seconds duration = chrono::seconds(10);
+    int64_t seed = 1;
+    Trace trace = TRACE_RANDOM;
+
+    /* Returns true in case of success or false otherwise. */
+    bool parse_args(int argc, char **argv) {
+        int opt;
+
+        while ((opt = getopt(argc, argv, "p:n:o:j:t:l:i:d:s:")) != -1) {
+            try {
+                switch (opt) {
+                    case 'p':
+                        string_to_int(optarg);
+                        game_server_port = optarg;
+                        break;
+                    case 'n':
+                        this->set_sessions_count(string_to_int(optarg));
+                        break;
+                    case 'o':
+                        this->set_observers_percent(string_to_int(optarg));
+                        break;
+                    case 'j':
+                        this->set_late_observers(string_to_int(optarg));
+                        break;
+                    case 't':
+                        trace = trace_from_name(optarg);
+                        break;
+                    case 'l':
+                        this->set_loss_percent(string_to_int(optarg));
+                        break;
+                    case 'i':
+                        this->set_send_interval(string_to_int(optarg));
+                        break;
+                    case 'd':
+                        this->set_duration(string_to_int(optarg));
+                        break;
+                    case 's':
+                        this->set_seed(string_to_int(optarg));
+                        break;
+                    default:
+                        return false;
+                }
+            }
+            catch (LimitException &e) {
+                exit_error(e.what());
+            }
+            catch (exception &e) {
+                return false;
+            }
+        }
+        if (optind + 1 != argc) { // Exactly one non-option argument
+            return false;
+        }
+        game_server = argv[optind];
+        return true;
+    }
+
+    void set_sessions_count(int64_t count) {
+        check_limits(count, MIN_SESSIONS, MAX_SESSIONS, "Sessions");
+        sessions_count = count;
+    }
+
+    void set_observers_percent(int64_t percent) {
+        check_limits(percent, MIN_PERCENT, MAX_PERCENT, "Observers percent");
+        observers_percent = percent;
+    }
+
+    void set_late_observers(int64_t count) {
+        check_limits(count, 0, MAX_SESSIONS, "Late observers");
+        late_observers = count;
+    }
+
+    void set_loss_percent(int64_t percent) {
+        check_limits(percent, MIN_PERCENT, MAX_PERCENT, "Loss percent");
+        loss_percent = percent;
+    }
+
+    void set_send_interval(int64_t millis) {
+        check_limits(millis, MIN_SEND_INTERVAL, MAX_SEND_INTERVAL, "Send interval");
+        send_interval = chrono::milliseconds(millis);
+    }
+
+    void set_duration(int64_t seconds) {
+        check_limits(seconds, MIN_DURATION, MAX_DURATION, "Duration");
+        duration = chrono::seconds(seconds);
+    }
+
+    void set_seed(int64_t _seed) {
+        check_limits(_seed, 1, INT32_MAX, "Seed");
+        seed = _seed;
+        loss_rng = Rng(seed);
+    }
+
+    /* Runs the swarm for its duration and prints report. Returns false if the server
+     * broke the protocol. */
+    bool run() {
+        raise_open_files_limit();
+        create_sessions();
+        epoll_event events[MAX_EPOLL_EVENTS];
+        SteadyTime now = chrono::steady_clock::now(), end = now + duration;
+
+        while (now < end) {
+            while (send_order.top().first <= now) {
+                SwarmSession &session = sessions[send_order.top().second];
+                send_order.pop();
+                send_message(session, now);
+                session.next_send += send_interval;
+                send_order.emplace(session.next_send, &session - sessions.data());
+            }
+
+            auto left = min(send_order.top().first, end) - now;
+            int timeout = (chrono::duration_cast<chrono::microseconds>(left).count() + 999)
+                          / 1000;
+            int ret = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+            if (ret < 0 && errno != EINTR) {
+                exit_error("Epoll wait error");
+            }
+            for (int i = 0; i < ret; ++i) {
+                receive(sessions[events[i].data.u32]);
+            }
+            now = chrono::steady_clock::now();
+        }
+
+        for (auto &session: sessions) {
+            check_board(session);
+        }
+        report();
+        return violations_total == 0;
+    }
+};
+
+int main(int argc, char **argv) {
+    Swarm swarm;
+    if (!swarm.parse_args(argc, argv)) {
+        exit_error("Usage: " + string(argv[0]) + " game_server -p server_port -n sessions "
+                   + "-o observers_percent -j late_observers -t straight|zigzag|random "
+                   + "-l loss_percent "
+                   + "-i send_interval_millis -d duration_seconds -s seed");
+    }
+    return swarm.run() ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+#ifndef SCREEN_WORMS_SCRIPTED_GAME_H
+#define SCREEN_WORMS_SCRIPTED_GAME_H
+
+#include <string>
+#include <vector>
+#include "../server/game_manager.cpp"
+#include "scripted_player.h"
+
+using namespace std;
+
+/* Game manager driven by scripted players, without sockets and without waiting for round
+ * deadlines. Players join once and play games back to back. Same settings, seed and trace
+ * always give the same games. */
+class ScriptedGame {
+private:
+    void count_events(const ServerMsg &msg) {
+        if (!msg.to_all) {
+            return;
+        }
+        if (msg.first_event == 0 && msg.last_event > 0) { // Only new game reports from start.
+            ++games;
+            round = 0;
+        }
+        events += msg.last_event - msg.first_event;
+    }
+
+public:
+    GameManager game_manager;
+    vector<ScriptedPlayer> players;
+    uint64_t games = 0;
+    uint64_t events = 0;
+    uint64_t rounds_run = 0;
+    uint64_t round = 0; // Round of the current game
+
+    ScriptedGame(const GameManager &settings, uint32_t players_count, Trace trace,
+                 int64_t seed) : game_manager(settings) {
+        game_manager.set_rng(seed);
+        for (uint32_t i = 0; i < players_count; ++i) {
+            players.emplace_back("player" + to_string(i), i, trace,
+                                 (int) ((seed + i + 1) % INT32_MAX));
+            ClientToServerMsg msg(1, 0, 0, players.back().name);
+            game_manager.new_participant(msg, players.back().name);
+        }
+    }
+
+    /* Passes message of every player to game manager, which starts a new game once all of
+     * them are ready, then performs a round if game is running. */
+    void step() {
+        bool started = game_manager.game_state.started;
+        for (auto &player: players) {
+            ClientToServerMsg msg(1, player.next_direction(started, round),
+                                  game_manager.game_state.events.size(), player.name);
+            count_events(game_manager.new_message(msg, player.name));
+        }
+        if (game_manager.game_state.started) {
+            count_events(game_manager.run_rounds(1));
+            ++rounds_run;
+            ++round;
+        }
+    }
+};
+
+#endif //SCREEN_WORMS_SCRIPTED_GAME_H
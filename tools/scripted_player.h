@@ -0,0 +1,68 @@
+#ifndef SCREEN_WORMS_SCRIPTED_PLAYER_H
+#define SCREEN_WORMS_SCRIPTED_PLAYER_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include "../utils/rng.h"
+
+#define TURN_CHANGE_ROUNDS 16 // Average number of rounds between turn changes in random trace
+#define ZIGZAG_ROUNDS 20 // Rounds between turn changes in zigzag trace
+
+using namespace std;
+
+/* How scripted players press keys during a game. */
+enum Trace {
+    TRACE_STRAIGHT, // Never turns
+    TRACE_ZIGZAG, // Turns right and left in turns, players shifted against each other
+    TRACE_RANDOM, // Changes turn direction at pseudo-random rounds
+};
+
+static const char *TRACE_NAMES[] = {"straight", "zigzag", "random"};
+
+/* Returns trace with given name. Throws invalid_argument if there is none. */
+inline Trace trace_from_name(const string &name) {
+    for (int trace = TRACE_STRAIGHT; trace <= TRACE_RANDOM; ++trace) {
+        if (name == TRACE_NAMES[trace]) {
+            return (Trace) trace;
+        }
+    }
+    throw invalid_argument("Unknown trace " + name);
+}
+
+/* Player whose turn direction depends only on its trace, number, seed and round. */
+class ScriptedPlayer {
+public:
+    string name;
+    uint32_t number;
+    Trace trace;
+    Rng rng;
+    uint8_t turn_direction = 0;
+
+    ScriptedPlayer(string _name, uint32_t _number, Trace _trace, int seed) :
+            name(std::move(_name)),
+            number(_number),
+            trace(_trace),
+            rng(seed) {}
+
+    /* Picks turn direction for given round of the game. Before game starts player always
+     * turns, so that it is ready. */
+    uint8_t next_direction(bool started, uint64_t round) {
+        if (!started) {
+            turn_direction = 1 + rng.get_random() % 2;
+        }
+        else if (trace == TRACE_STRAIGHT) {
+            turn_direction = 0;
+        }
+        else if (trace == TRACE_ZIGZAG) {
+            turn_direction = 1 + (round / ZIGZAG_ROUNDS + number) % 2;
+        }
+        else if (rng.get_random() % TURN_CHANGE_ROUNDS == 0) {
+            turn_direction = rng.get_random() % 3;
+        }
+        return turn_direction;
+    }
+};
+
+#endif //SCREEN_WORMS_SCRIPTED_PLAYER_H
@@ -0,0 +1,55 @@
+#ifndef SCREEN_WORMS_CRC32_H
+#define SCREEN_WORMS_CRC32_H
+
+#include <cstdint>
+#include <cstddef>
+
+/* Implementations of CRC-32-IEEE. All of them compute the same value, the fastest one
+ * supported by the CPU is chosen at runtime and used by crc32() and Crc32. */
+enum Crc32Kernel {
+    CRC32_REFERENCE = 0, // byte at a time table lookup
+    CRC32_SLICE_BY_8 = 1,
+    CRC32_SLICE_BY_16 = 2,
+    CRC32_PCLMUL = 3, // carry-less multiplication folding, x86-64 with PCLMULQDQ and SSE4.1
+};
+
+/* Returns checksum of given data using the fastest available kernel. */
+uint32_t crc32(const char *data, uint32_t size);
+
+/* Returns checksum of given data using the byte at a time algorithm. */
+uint32_t crc32_reference(const char *data, uint32_t size);
+
+bool crc32_kernel_supported(Crc32Kernel kernel);
+
+/* Returns kernel used by crc32() and Crc32. */
+Crc32Kernel crc32_best_kernel();
+
+const char *crc32_kernel_name(Crc32Kernel kernel);
+
+/* Continues computation of checksum in state (which is the inverted checksum of data
+ * processed so far) with given kernel and returns the new state. Kernel must be
+ * supported. */
+uint32_t crc32_update(Crc32Kernel kernel, uint32_t state, const char *data, size_t size);
+
+/* Incremental checksum computation for data which comes in parts. */
+class Crc32 {
+private:
+    uint32_t state = ~0U;
+
+public:
+    Crc32() = default;
+
+    void update(const char *data, size_t size) {
+        state = crc32_update(crc32_best_kernel(), state, data, size);
+    }
+
+    uint32_t value() const {
+        return state ^ ~0U;
+    }
+
+    void reset() {
+        state = ~0U;
+    }
+};
+
+#endif //SCREEN_WORMS_CRC32_H
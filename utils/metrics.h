@@ -0,0 +1,155 @@
+#ifndef SCREEN_WORMS_METRICS_H
+#define SCREEN_WORMS_METRICS_H
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS) // Buckets of every power of two
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+using namespace std;
+
+/* Value written by a single thread and read by any. Writer does a relaxed load and store
+ * instead of a locked read-modify-write, so it costs about as much as a plain integer. */
+class Gauge {
+protected:
+    atomic<uint64_t> value{0};
+
+public:
+    Gauge() = default;
+
+    Gauge(const Gauge &other) : value(other.load()) {}
+
+    Gauge &operator=(const Gauge &other) {
+        set(other.load());
+        return *this;
+    }
+
+    void set(uint64_t _value) {
+        value.store(_value, memory_order_relaxed);
+    }
+
+    uint64_t load() const {
+        return value.load(memory_order_relaxed);
+    }
+
+    operator uint64_t() const {
+        return load();
+    }
+};
+
+/* Gauge which only grows. */
+class Counter : public Gauge {
+public:
+    Counter &operator+=(uint64_t n) {
+        set(load() + n);
+        return *this;
+    }
+
+    Counter &operator++() {
+        return *this += 1;
+    }
+};
+
+/* Histogram of durations in nanoseconds with buckets of bounded relative width, like HDR
+ * histograms. Values below HISTOGRAM_SUB_BUCKETS have buckets of their own, every greater
+ * power of two is split into HISTOGRAM_SUB_BUCKETS equal ones, so quantiles are off by at
+ * most 1/HISTOGRAM_SUB_BUCKETS. Recording takes a few shifts and counter updates. Written
+ * by a single thread and read by any, reader may see a record half done. */
+class LatencyHistogram {
+private:
+    Counter buckets[HISTOGRAM_BUCKETS];
+
+    static size_t bucket(uint64_t value) {
+        if (value < HISTOGRAM_SUB_BUCKETS) {
+            return value;
+        }
+        int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+        return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (value >> shift) - HISTOGRAM_SUB_BUCKETS;
+    }
+
+    /* Returns the greatest value falling into given bucket. */
+    static uint64_t bucket_max(size_t bucket) {
+        if (bucket < HISTOGRAM_SUB_BUCKETS) {
+            return bucket;
+        }
+        size_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+        uint64_t first = bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+        return ((first + 1) << shift) - 1;
+    }
+
+public:
+    Counter count;
+    Counter sum;
+    Gauge maximum;
+
+    void record(uint64_t value) {
+        ++buckets[bucket(value)];
+        ++count;
+        sum += value;
+        if (value > maximum.load()) {
+            maximum.set(value);
+        }
+    }
+
+    /* Returns value which given fraction of recorded values does not exceed, rounded up to
+     * the end of its bucket. */
+    uint64_t quantile(double fraction) const {
+        uint64_t total = count.load(), seen = 0;
+        uint64_t rank = max((uint64_t) 1, (uint64_t) ceil(fraction * total));
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS && total > 0; ++i) {
+            seen += buckets[i].load();
+            if (seen >= rank) {
+                return min(bucket_max(i), maximum.load());
+            }
+        }
+        return maximum.load();
+    }
+};
+
+/* Builds metrics in the text exposition format of Prometheus. All samples of a metric
+ * have to follow its description. */
+class MetricsWriter {
+private:
+    static string format(double value) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.9g", value);
+        return buffer;
+    }
+
+    void line(const string &name, const string &labels, const string &value) {
+        text += name;
+        if (!labels.empty()) {
+            text += "{" + labels + "}";
+        }
+        text += " " + value + "\n";
+    }
+
+public:
+    string text;
+
+    void describe(const string &name, const string &type, const string &help) {
+        text += "# HELP " + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+    }
+
+    void sample(const string &name, const string &labels, uint64_t value) {
+        line(name, labels, to_string(value));
+    }
+
+    /* Writes histogram of nanoseconds as summary in seconds. */
+    void summary(const string &name, const string &labels, const LatencyHistogram &histogram) {
+        string separator = labels.empty() ? "" : ",";
+        for (double fraction: {0.5, 0.9, 0.99, 0.999, 1.0}) {
+            line(name, labels + separator + "quantile=\"" + format(fraction) + "\"",
+                 format(histogram.quantile(fraction) / 1e9));
+        }
+        line(name + "_sum", labels, format(histogram.sum.load() / 1e9));
+        line(name + "_count", labels, to_string(histogram.count.load()));
+    }
+};
+
+#endif //SCREEN_WORMS_METRICS_H
@@ -0,0 +1,92 @@
+#ifndef SCREEN_WORMS_TICK_SCHEDULER_H
+#define SCREEN_WORMS_TICK_SCHEDULER_H
+
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+/* What to do with rounds which were missed because the server fell behind schedule. */
+enum CatchUpPolicy {
+    CATCH_UP_BURST, // Run missed rounds back to back, at most max_catch_up at once
+    CATCH_UP_SKIP, // Run a single round, missed ones are dropped
+};
+
+/* How late ticks were run relatively to their deadlines. */
+class TickStats {
+public:
+    uint64_t ticks = 0;
+    uint64_t late_ticks = 0; // Ticks run at least a whole period after their deadline
+    uint64_t skipped_ticks = 0;
+    chrono::nanoseconds total_lateness{0};
+    chrono::nanoseconds max_lateness{0};
+    chrono::nanoseconds last_lateness{0};
+
+    void record(chrono::nanoseconds lateness, chrono::nanoseconds period) {
+        ++ticks;
+        last_lateness = lateness;
+        total_lateness += lateness;
+        max_lateness = max(max_lateness, lateness);
+        if (lateness >= period) {
+            ++late_ticks;
+        }
+    }
+
+    chrono::nanoseconds mean_lateness() const {
+        return ticks == 0 ? chrono::nanoseconds(0) : total_lateness / (int64_t) ticks;
+    }
+};
+
+/* Schedules ticks of fixed period at absolute deadlines start + n * period on the monotonic
+ * clock. Time spent processing a tick does not delay the following ones and wall clock
+ * adjustments have no effect. */
+class TickScheduler {
+private:
+    chrono::steady_clock::time_point start_time;
+    chrono::nanoseconds period{1};
+    uint64_t next_tick = 1;
+
+    chrono::steady_clock::time_point deadline(uint64_t tick) const {
+        return start_time + tick * period;
+    }
+
+public:
+    CatchUpPolicy policy = CATCH_UP_BURST;
+    uint32_t max_catch_up = 4;
+    TickStats stats;
+
+    TickScheduler() = default;
+
+    /* Starts schedule with first tick due one period from now. */
+    void start(chrono::nanoseconds _period) {
+        period = _period;
+        start_time = chrono::steady_clock::now();
+        next_tick = 1;
+    }
+
+    /* Returns time left until next tick is due, zero if it is already due. */
+    chrono::nanoseconds time_left() const {
+        auto left = deadline(next_tick) - chrono::steady_clock::now();
+        return max(chrono::duration_cast<chrono::nanoseconds>(left), chrono::nanoseconds(0));
+    }
+
+    /* Returns number of ticks which should be run now and moves schedule past them. Ticks
+     * which are due but exceed catch-up limit of the policy are skipped. */
+    uint32_t due_ticks() {
+        auto now = chrono::steady_clock::now();
+        if (now < deadline(next_tick)) {
+            return 0;
+        }
+
+        auto lateness = chrono::duration_cast<chrono::nanoseconds>(now - deadline(next_tick));
+        uint64_t due = lateness / period + 1;
+        uint64_t run = policy == CATCH_UP_SKIP ? 1 : min(due, (uint64_t) max_catch_up);
+        stats.record(lateness, period);
+        stats.skipped_ticks += due - run;
+        next_tick += due;
+        return run;
+    }
+};
+
+#endif //SCREEN_WORMS_TICK_SCHEDULER_H
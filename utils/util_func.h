@@ -6,8 +6,6 @@
 #include <vector>
 #include "../common/const.h"
 
-uint32_t crc32(const char *data, uint32_t size);
-
 int64_t string_to_int(const std::string &str);
 
 void check_limits(int64_t value, int64_t lower_bound, int64_t upper_bound,
@@ -15,21 +13,26 @@ void check_limits(int64_t value, int64_t lower_bound, int64_t upper_bound,
 
 bool player_name_valid(const std::string &name);
 
-struct addrinfo resolve_host(const std::string& addr, int type, const std::string &port);
+/* Address of returned host is copied into given storage, which must outlive its use. */
+struct addrinfo resolve_host(const std::string& addr, int type, const std::string &port,
+                             struct sockaddr_storage &storage);
 
 std::vector<std::string> split(const std::string &str, const std::string &delimiter);
 
-std::string serialize8(uint8_t num);
+/* Serializing functions write number at the beginning of given bytes and return number of
+ * bytes written. */
+size_t serialize8(uint8_t num, char *bytes);
 
-std::string serialize32(uint32_t num);
+size_t serialize32(uint32_t num, char *bytes);
 
-std::string serialize64(uint64_t num);
+size_t serialize64(uint64_t num, char *bytes);
 
-uint8_t deserialize8(const std::string &str);
+/* Deserializing functions read number from the beginning of given bytes. */
+uint8_t deserialize8(const char *bytes);
 
-uint32_t deserialize32(const std::string &str);
+uint32_t deserialize32(const char *bytes);
 
-uint64_t deserialize64(const std::string &str);
+uint64_t deserialize64(const char *bytes);
 
 void exit_error(const std::string &msg);
 
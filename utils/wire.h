@@ -0,0 +1,127 @@
+#ifndef SCREEN_WORMS_WIRE_H
+#define SCREEN_WORMS_WIRE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <cstring>
+#include "util_func.h"
+#include "../common/exceptions.h"
+
+/* Bounds-checked cursor over received bytes. Numbers are decoded in place from network
+ * byte order and byte ranges are returned as views into the buffer, so reading does not
+ * copy or allocate. Reading past the end throws TruncatedMessageException. */
+class ByteReader {
+private:
+    const char *data;
+    size_t size;
+    size_t pos = 0;
+
+    /* Returns pointer to next n bytes and moves cursor behind them. */
+    const char *take(size_t n) {
+        if (size - pos < n) {
+            throw TruncatedMessageException();
+        }
+        const char *ret = data + pos;
+        pos += n;
+        return ret;
+    }
+
+public:
+    ByteReader(const char *_data, size_t _size) : data(_data), size(_size) {}
+
+    explicit ByteReader(std::string_view bytes) : data(bytes.data()), size(bytes.size()) {}
+
+    uint8_t read8() {
+        return deserialize8(take(sizeof(uint8_t)));
+    }
+
+    uint32_t read32() {
+        return deserialize32(take(sizeof(uint32_t)));
+    }
+
+    uint64_t read64() {
+        return deserialize64(take(sizeof(uint64_t)));
+    }
+
+    std::string_view read_bytes(size_t n) {
+        return std::string_view(take(n), n);
+    }
+
+    /* Returns all bytes left. */
+    std::string_view read_rest() {
+        return read_bytes(remaining());
+    }
+
+    /* Returns pointer to the byte under cursor. */
+    const char *current() const {
+        return data + pos;
+    }
+
+    size_t remaining() const {
+        return size - pos;
+    }
+
+    bool empty() const {
+        return pos == size;
+    }
+};
+
+/* Cursor writing fields in network byte order directly into caller-provided buffer, for
+ * example a single datagram. Writing more than the buffer holds throws
+ * BufferTooSmallException. */
+class ByteWriter {
+private:
+    char *data;
+    size_t capacity;
+    size_t pos = 0;
+
+    /* Returns pointer to next n bytes and moves cursor behind them. */
+    char *take(size_t n) {
+        if (capacity - pos < n) {
+            throw BufferTooSmallException();
+        }
+        char *ret = data + pos;
+        pos += n;
+        return ret;
+    }
+
+public:
+    ByteWriter(char *_data, size_t _capacity) : data(_data), capacity(_capacity) {}
+
+    void write8(uint8_t num) {
+        serialize8(num, take(sizeof(uint8_t)));
+    }
+
+    void write32(uint32_t num) {
+        serialize32(num, take(sizeof(uint32_t)));
+    }
+
+    void write64(uint64_t num) {
+        serialize64(num, take(sizeof(uint64_t)));
+    }
+
+    void write_bytes(const char *bytes, size_t n) {
+        memcpy(take(n), bytes, n);
+    }
+
+    void write_bytes(std::string_view bytes) {
+        write_bytes(bytes.data(), bytes.size());
+    }
+
+    /* Returns pointer to the beginning of the buffer. */
+    const char *begin() const {
+        return data;
+    }
+
+    /* Returns number of bytes written so far. */
+    size_t size() const {
+        return pos;
+    }
+
+    size_t remaining() const {
+        return capacity - pos;
+    }
+};
+
+#endif //SCREEN_WORMS_WIRE_H